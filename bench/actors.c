@@ -0,0 +1,351 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "actor.h"
+#include "actor_group.h"
+#include "actor_system.h"
+#include "message.h"
+#include "promise.h"
+
+/* Workloads are sized from options->ops, scaled down: an actor message costs
+   far more than a fifo push. */
+#define BENCH_ACTOR_OPS_DIVISOR 10
+#define BENCH_RING_ACTORS 100
+#define BENCH_FAN_OUT_ACTORS 1000
+#define BENCH_ZIPF_ACTORS 10000
+#define BENCH_ZIPF_EXPONENT 1.0
+/* latency samples kept per worker, per run */
+#define BENCH_ACTOR_SAMPLES (1 << 16)
+
+/* What each worker has seen; only that worker writes to its slot */
+typedef struct {
+  _Alignas(64) atomic_long received;
+  bench_samples_t *samples;
+} bench_slot_t;
+
+/* The run in progress: one at a time */
+typedef struct {
+  actor_system_t *actor_system;
+  bench_slot_t *slots; // one per worker
+  actor_t **actors;
+  long actor_count;
+  long hops;           // ring: hops the token makes in all
+  long lap_start;      // ring: when the token last left actor 0
+  long promises;       // promises created before the run
+  long rss_kb;         // resident set before the run
+} bench_actor_run_t;
+
+static bench_actor_run_t run;
+
+long bench_actor_received_total() {
+  long total = 0;
+  int i = 0;
+  for ( i = 0; i < run.actor_system->thread_pool->worker_count; i++ ) {
+    total += atomic_load_explicit( &run.slots[i].received, memory_order_acquire );
+  }
+  return total;
+}
+
+/* Count the message, and sample one in BENCH_SAMPLE_EVERY of the one-way
+   latencies of messages that carry their send time */
+void bench_actor_received( actor_t *actor, message_t *msg, int sample ) {
+  bench_slot_t *slot = &run.slots[thread_pool_worker_index( run.actor_system->thread_pool )];
+  long received = atomic_load_explicit( &slot->received, memory_order_relaxed );
+  if ( sample && msg->data && !(received & (BENCH_SAMPLE_EVERY - 1)) ) {
+    bench_samples_add( slot->samples, bench_now_ns() - *(long*) msg->data );
+  }
+  atomic_store_explicit( &slot->received, received + 1, memory_order_release );
+}
+
+/* one message of 'type', carrying its send time */
+message_t *bench_actor_message( actor_t *to, int type ) {
+  long now = bench_now_ns();
+  return actor_message_create_copy( to, &now, sizeof(now), type );
+}
+
+/* Resident set right now, from /proc/self/statm. getrusage()'s ru_maxrss is
+   the peak over the whole process, so it would only ever grow across runs. */
+long bench_actor_rss_kb() {
+  long pages = 0;
+  long resident = 0;
+  FILE *statm = fopen( "/proc/self/statm", "r" );
+  if ( !statm ) {
+    return 0;
+  }
+  if ( fscanf( statm, "%ld %ld", &pages, &resident ) != 2 ) {
+    resident = 0;
+  }
+  fclose( statm );
+  return resident * (sysconf( _SC_PAGESIZE ) / 1024);
+}
+
+void bench_actor_run_create( int threads, long actor_count, receive_func_p receive ) {
+  run.rss_kb = bench_actor_rss_kb();
+  actor_system_config_t config;
+  actor_system_config_init( &config );
+  config.thread_count = threads;
+  config.scheduler = THREAD_POOL_WORK_STEALING;
+  run.actor_system = actor_system_create_with_config( "bench", &config );
+  run.slots = (bench_slot_t*) aligned_alloc( 64, threads * sizeof(bench_slot_t) );
+  int i = 0;
+  for ( i = 0; i < threads; i++ ) {
+    atomic_init( &run.slots[i].received, 0 );
+    run.slots[i].samples = bench_samples_create( BENCH_ACTOR_SAMPLES );
+  }
+  run.actor_count = actor_count;
+  run.actors = (actor_t**) malloc( actor_count * sizeof(actor_t*) );
+  long a = 0;
+  for ( a = 0; a < actor_count; a++ ) {
+    run.actors[a] = actor_create( receive, "bench" );
+    actor_system_add( run.actor_system, run.actors[a] );
+  }
+  long live = 0;
+  promise_counts( &run.promises, &live );
+  actor_system_run( run.actor_system );
+}
+
+void bench_actor_wait( long received ) {
+  while ( bench_actor_received_total() < received ) {
+    sched_yield();
+  }
+}
+
+/* Report, then tear the run down. 'messages' is what the workload sent. */
+void bench_actor_run_report( const char *bench, const char *params, const char *latency, long messages, long elapsed, bench_samples_t *samples ) {
+  int threads = run.actor_system->thread_pool->worker_count;
+  actor_system_stats_t *stats = actor_system_stats( run.actor_system );
+  long promises = 0;
+  long live = 0;
+  promise_counts( &promises, &live );
+  long allocs = stats->message_allocs + promises - run.promises;
+  actor_system_stats_destroy( stats );
+  // what the run added: its actors, messages and samples are all still live here
+  long rss_kb = bench_actor_rss_kb() - run.rss_kb;
+
+  bench_samples_t *merged = samples ? samples : bench_samples_create( BENCH_ACTOR_SAMPLES );
+  int i = 0;
+  for ( i = 0; !samples && i < threads; i++ ) {
+    bench_samples_merge( merged, run.slots[i].samples );
+  }
+  char all[256];
+  snprintf( all, sizeof(all), "%s%s\"threads\":%i,\"latency\":\"%s\",\"rss_run_kb\":%li,\"allocs_per_msg\":%.3f",
+      params, params[0] ? "," : "", threads, latency, rss_kb,
+      messages > 0 ? (double) allocs / messages : 0.0 );
+  bench_report( bench, all, messages, elapsed, merged );
+  if ( merged != samples ) {
+    bench_samples_destroy( merged );
+  }
+
+  long a = 0;
+  for ( a = 0; a < run.actor_count; a++ ) {
+    actor_kill( run.actors[a], NULL );
+  }
+  thread_pool_join_all( run.actor_system->thread_pool );
+  actor_system_destroy( run.actor_system );
+  for ( a = 0; a < run.actor_count; a++ ) {
+    actor_destroy( run.actors[a] );
+  }
+  free( run.actors );
+  for ( i = 0; i < threads; i++ ) {
+    bench_samples_destroy( run.slots[i].samples );
+  }
+  free( run.slots );
+}
+
+/* ---- ring: a token goes round N actors, 'hops' times in all ---- */
+
+promise_t *bench_ring_receive( actor_t *this, message_t *msg ) {
+  long index = this->pid - 1;
+  if ( index == 0 ) {
+    long now = bench_now_ns();
+    if ( msg->id > 0 ) {
+      bench_samples_add( run.slots[thread_pool_worker_index( run.actor_system->thread_pool )].samples, now - run.lap_start );
+    }
+    run.lap_start = now;
+  }
+  /* counted last: the main thread reads the samples once the count is in */
+  bench_actor_received( this, msg, 0 );
+  if ( msg->id + 1 < run.hops ) {
+    message_t *token = actor_message_create( this, NULL, 0 );
+    token->id = msg->id + 1;
+    actor_tell( run.actors[(index + 1) % run.actor_count], token );
+  }
+  return NULL;
+}
+
+void bench_ring_run( long hops, int threads ) {
+  bench_actor_run_create( threads, BENCH_RING_ACTORS, &bench_ring_receive );
+  run.hops = hops;
+  long start = bench_now_ns();
+  message_t *token = actor_message_create( run.actors[0], NULL, 0 );
+  token->id = 0;
+  actor_tell( run.actors[0], token );
+  bench_actor_wait( hops );
+  char params[32];
+  snprintf( params, sizeof(params), "\"actors\":%i", BENCH_RING_ACTORS );
+  bench_actor_run_report( "actor_ring", params, "lap", hops, bench_now_ns() - start, NULL );
+}
+
+/* ---- fan-in: 'producers' threads tell one aggregator ---- */
+
+promise_t *bench_sink_receive( actor_t *this, message_t *msg ) {
+  bench_actor_received( this, msg, 1 );
+  return NULL;
+}
+
+typedef struct {
+  actor_t *to;
+  long count;
+} bench_producer_t;
+
+void *bench_fan_in_producer( void *arg ) {
+  bench_producer_t *producer = (bench_producer_t*) arg;
+  long i = 0;
+  for ( i = 0; i < producer->count; i++ ) {
+    actor_tell( producer->to, bench_actor_message( producer->to, 0 ) );
+  }
+  return NULL;
+}
+
+void bench_fan_in_run( long messages, int threads ) {
+  bench_actor_run_create( threads, 1, &bench_sink_receive );
+  int producers = threads;
+  pthread_t senders[producers];
+  bench_producer_t args[producers];
+  long start = bench_now_ns();
+  int i = 0;
+  for ( i = 0; i < producers; i++ ) {
+    args[i].to = run.actors[0];
+    args[i].count = messages / producers;
+    pthread_create( &senders[i], NULL, &bench_fan_in_producer, &args[i] );
+  }
+  for ( i = 0; i < producers; i++ ) {
+    pthread_join( senders[i], NULL );
+  }
+  bench_actor_wait( messages / producers * producers );
+  char params[32];
+  snprintf( params, sizeof(params), "\"producers\":%i", producers );
+  bench_actor_run_report( "actor_fan_in", params, "one_way", messages / producers * producers, bench_now_ns() - start, NULL );
+}
+
+/* ---- fan-out: one sender broadcasts to a group ---- */
+
+void bench_fan_out_run( long messages, int threads ) {
+  bench_actor_run_create( threads, BENCH_FAN_OUT_ACTORS, &bench_sink_receive );
+  actor_group_t *group = actor_group_create( run.actor_system, "bench" );
+  long a = 0;
+  for ( a = 0; a < run.actor_count; a++ ) {
+    actor_group_add( group, run.actors[a] );
+  }
+  long rounds = messages / BENCH_FAN_OUT_ACTORS > 0 ? messages / BENCH_FAN_OUT_ACTORS : 1;
+  long start = bench_now_ns();
+  long i = 0;
+  for ( i = 0; i < rounds; i++ ) {
+    long now = bench_now_ns();
+    actor_broadcast( group, 0, &now, sizeof(now) );
+  }
+  bench_actor_wait( rounds * BENCH_FAN_OUT_ACTORS );
+  char params[32];
+  snprintf( params, sizeof(params), "\"actors\":%i", BENCH_FAN_OUT_ACTORS );
+  bench_actor_run_report( "actor_fan_out", params, "one_way", rounds * BENCH_FAN_OUT_ACTORS, bench_now_ns() - start, NULL );
+}
+
+/* ---- request/response: each request is passed down a chain of 'depth'
+   actors, and the last one's reply resolves the caller's promise ---- */
+
+promise_t *bench_chain_receive( actor_t *this, message_t *msg ) {
+  bench_actor_received( this, msg, 0 );
+  long index = this->pid - 1;
+  if ( index + 1 < run.actor_count ) {
+    actor_t *next = run.actors[index + 1];
+    return actor_send( next, actor_message_create( this, NULL, 0 ) );
+  }
+  return promise_resolved( this );
+}
+
+void bench_chain_run( long messages, int threads, int depth ) {
+  bench_actor_run_create( threads, depth, &bench_chain_receive );
+  long rounds = messages / depth > 0 ? messages / depth : 1;
+  bench_samples_t *samples = bench_samples_create( rounds );
+  long start = bench_now_ns();
+  long i = 0;
+  for ( i = 0; i < rounds; i++ ) {
+    long sent = bench_now_ns();
+    promise_get( actor_send( run.actors[0], actor_message_create( run.actors[0], NULL, 0 ) ) );
+    bench_samples_add( samples, bench_now_ns() - sent );
+  }
+  char params[32];
+  snprintf( params, sizeof(params), "\"depth\":%i", depth );
+  bench_actor_run_report( "actor_request_chain", params, "round_trip", rounds * depth, bench_now_ns() - start, samples );
+  bench_samples_destroy( samples );
+}
+
+/* ---- skewed: messages go to 10k actors, picked with a Zipf distribution ---- */
+
+/* Targets drawn up front, from a fixed seed, so every run sends the same */
+long *bench_zipf_targets( long count, long actors, double exponent ) {
+  double *cdf = (double*) malloc( actors * sizeof(double) );
+  double total = 0;
+  long a = 0;
+  for ( a = 0; a < actors; a++ ) {
+    total += 1.0 / pow( (double) (a + 1), exponent );
+    cdf[a] = total;
+  }
+  long *targets = (long*) malloc( count * sizeof(long) );
+  unsigned int seed = 42;
+  long i = 0;
+  for ( i = 0; i < count; i++ ) {
+    double u = (double) rand_r( &seed ) / RAND_MAX * total;
+    long lo = 0;
+    long hi = actors - 1;
+    while ( lo < hi ) {
+      long mid = (lo + hi) / 2;
+      if ( cdf[mid] < u ) {
+        lo = mid + 1;
+      } else {
+        hi = mid;
+      }
+    }
+    targets[i] = lo;
+  }
+  free( cdf );
+  return targets;
+}
+
+void bench_zipf_run( long messages, int threads, long *targets ) {
+  bench_actor_run_create( threads, BENCH_ZIPF_ACTORS, &bench_sink_receive );
+  long start = bench_now_ns();
+  long i = 0;
+  for ( i = 0; i < messages; i++ ) {
+    actor_t *to = run.actors[targets[i]];
+    actor_tell( to, bench_actor_message( to, 0 ) );
+  }
+  bench_actor_wait( messages );
+  char params[64];
+  snprintf( params, sizeof(params), "\"actors\":%i,\"exponent\":%.1f", BENCH_ZIPF_ACTORS, BENCH_ZIPF_EXPONENT );
+  bench_actor_run_report( "actor_zipf", params, "one_way", messages, bench_now_ns() - start, NULL );
+}
+
+void bench_actors( bench_options_t *options ) {
+  long messages = options->ops / BENCH_ACTOR_OPS_DIVISOR > 0 ? options->ops / BENCH_ACTOR_OPS_DIVISOR : 1;
+  int depths[] = { 1, 4, 16 };
+  long *targets = bench_zipf_targets( messages, BENCH_ZIPF_ACTORS, BENCH_ZIPF_EXPONENT );
+  int threads = 1;
+  for ( threads = 1; threads <= options->max_threads; threads = bench_next_threads( threads, options->max_threads ) ) {
+    bench_ring_run( messages, threads );
+    bench_fan_in_run( messages, threads );
+    bench_fan_out_run( messages, threads );
+    int d = 0;
+    for ( d = 0; d < 3; d++ ) {
+      bench_chain_run( messages / 10 > 0 ? messages / 10 : 1, threads, depths[d] );
+    }
+    bench_zipf_run( messages, threads, targets );
+  }
+  free( targets );
+}
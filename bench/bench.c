@@ -0,0 +1,137 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "bench.h"
+#include "logger.h"
+#include "threads.h"
+
+typedef struct {
+  const char *name;
+  void (*run)( bench_options_t *options );
+} bench_t;
+
+static bench_t benches[] = {
+  { "fifo", &bench_fifo },
+  { "thread_pool", &bench_thread_pool },
+  { "promise", &bench_promise },
+  { "message_pool", &bench_message_pool },
+  { "actors", &bench_actors },
+};
+
+long bench_now_ns() {
+  struct timespec now;
+  clock_gettime( CLOCK_MONOTONIC, &now );
+  return (long) now.tv_sec * 1000000000L + now.tv_nsec;
+}
+
+bench_samples_t *bench_samples_create( long capacity ) {
+  bench_samples_t *samples = (bench_samples_t*) malloc( sizeof(bench_samples_t) );
+  samples->ns = (long*) malloc( (capacity > 0 ? capacity : 1) * sizeof(long) );
+  samples->count = 0;
+  samples->capacity = capacity;
+  return samples;
+}
+
+void bench_samples_add( bench_samples_t *samples, long ns ) {
+  if ( samples->count < samples->capacity ) {
+    samples->ns[samples->count++] = ns;
+  }
+}
+
+void bench_samples_merge( bench_samples_t *into, bench_samples_t *from ) {
+  long i = 0;
+  for ( i = 0; i < from->count; i++ ) {
+    bench_samples_add( into, from->ns[i] );
+  }
+}
+
+void bench_samples_destroy( bench_samples_t *samples ) {
+  if ( samples ) {
+    free( samples->ns );
+    free( samples );
+  }
+}
+
+int bench_compare_longs_internal( const void *a, const void *b ) {
+  long x = *(const long*) a;
+  long y = *(const long*) b;
+  return (x > y) - (x < y);
+}
+
+/* nearest-rank percentile of sorted samples */
+long bench_percentile_internal( bench_samples_t *samples, double percentile ) {
+  if ( !samples || samples->count == 0 ) {
+    return 0;
+  }
+  long rank = (long) (percentile * samples->count / 100.0);
+  return samples->ns[rank < samples->count ? rank : samples->count - 1];
+}
+
+void bench_report( const char *bench, const char *params, long ops, long elapsed_ns, bench_samples_t *samples ) {
+  if ( samples ) {
+    qsort( samples->ns, samples->count, sizeof(long), &bench_compare_longs_internal );
+  }
+  double seconds = elapsed_ns / 1e9;
+  printf( "{\"bench\":\"%s\"%s%s,\"ops\":%li,\"seconds\":%.6f,\"ops_per_sec\":%.0f,"
+      "\"p50_ns\":%li,\"p99_ns\":%li,\"p999_ns\":%li}\n",
+      bench, params[0] ? "," : "", params, ops, seconds, seconds > 0 ? ops / seconds : 0.0,
+      bench_percentile_internal( samples, 50 ), bench_percentile_internal( samples, 99 ),
+      bench_percentile_internal( samples, 99.9 ) );
+  fflush( stdout );
+}
+
+int bench_next_threads( int threads, int max ) {
+  if ( threads >= max ) {
+    return max + 1;
+  }
+  return threads * 2 < max ? threads * 2 : max;
+}
+
+void bench_usage_internal( const char *self ) {
+  fprintf( stderr, "usage: %s [-o ops] [-t max_threads] [bench ...]\nbenches:", self );
+  size_t i = 0;
+  for ( i = 0; i < sizeof(benches) / sizeof(benches[0]); i++ ) {
+    fprintf( stderr, " %s", benches[i].name );
+  }
+  fprintf( stderr, "\n" );
+}
+
+int main( int argc, char *argv[] ) {
+  bench_options_t options;
+  options.ops = BENCH_DEFAULT_OPS;
+  options.max_threads = dna_cpu_count();
+  dna_log_set_level( ERROR );
+
+  int first = 1;
+  while ( first < argc && argv[first][0] == '-' ) {
+    if ( !strcmp( argv[first], "-o" ) && first + 1 < argc ) {
+      options.ops = atol( argv[first + 1] );
+    } else if ( !strcmp( argv[first], "-t" ) && first + 1 < argc ) {
+      options.max_threads = atoi( argv[first + 1] );
+    } else {
+      bench_usage_internal( argv[0] );
+      return 1;
+    }
+    first += 2;
+  }
+  if ( options.ops <= 0 || options.max_threads <= 0 ) {
+    bench_usage_internal( argv[0] );
+    return 1;
+  }
+
+  size_t i = 0;
+  for ( i = 0; i < sizeof(benches) / sizeof(benches[0]); i++ ) {
+    int selected = first == argc;
+    int arg = 0;
+    for ( arg = first; arg < argc; arg++ ) {
+      selected |= !strcmp( argv[arg], benches[i].name );
+    }
+    if ( selected ) {
+      benches[i].run( &options );
+    }
+  }
+  dna_log_flush();
+  return 0;
+}
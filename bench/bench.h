@@ -0,0 +1,57 @@
+#ifndef _MELON_BENCH_H_
+#define _MELON_BENCH_H_
+
+/***
+* melon-bench: repeatable benchmarks.
+*
+* Every result is one JSON object on a line of its own, on stdout:
+*   {"bench":"fifo","producers":2,"consumers":2,"ops":1000000,"ops_per_sec":...,
+*    "p50_ns":...,"p99_ns":...,"p999_ns":...}
+* so that runs can be diffed, or fed to a script that catches regressions.
+* Logging is turned down to errors, to keep stdout to results.
+*
+* Latencies are taken around one operation in BENCH_SAMPLE_EVERY (a power of
+* 2), and include the cost of reading the clock, ~20ns; throughput is measured
+* over the whole run. For queues (fifo, thread_pool) latency is an item's wait,
+* from push to pop or enqueue to run, so a flood shows up as its backlog.
+*/
+
+#define BENCH_SAMPLE_EVERY 16
+#define BENCH_DEFAULT_OPS 1000000
+
+typedef struct bench_options_t bench_options_t;
+typedef struct bench_samples_t bench_samples_t;
+
+struct bench_options_t {
+  long ops;        // operations per run, before any per-benchmark scaling
+  int max_threads; // thread counts are swept 1, 2, 4 ... up to this
+};
+
+/* Latency samples, in nanoseconds. Not thread safe: one per thread, then merge. */
+struct bench_samples_t {
+  long *ns;
+  long count;
+  long capacity; // further samples are dropped
+};
+
+long bench_now_ns();
+bench_samples_t *bench_samples_create( long capacity );
+void bench_samples_add( bench_samples_t *samples, long ns );
+void bench_samples_merge( bench_samples_t *into, bench_samples_t *from );
+void bench_samples_destroy( bench_samples_t *samples );
+
+/* One result line. 'params' are extra JSON members, e.g. "\"producers\":2", or "". */
+void bench_report( const char *bench, const char *params, long ops, long elapsed_ns, bench_samples_t *samples );
+
+/* the next thread count of a 1, 2, 4 ... sweep that ends exactly at 'max' */
+int bench_next_threads( int threads, int max );
+
+/* bench/primitives.c */
+void bench_fifo( bench_options_t *options );
+void bench_thread_pool( bench_options_t *options );
+void bench_promise( bench_options_t *options );
+void bench_message_pool( bench_options_t *options );
+/* bench/actors.c: ring, fan-in, fan-out, request chains and a Zipf-skewed load */
+void bench_actors( bench_options_t *options );
+
+#endif // _MELON_BENCH_H_
@@ -0,0 +1,328 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+
+#include "bench.h"
+#include "fifo.h"
+#include "thread_pool.h"
+#include "promise.h"
+#include "message.h"
+#include "actor_system.h"
+
+/* Wait for a counter the benchmark's tasks bump, without taking a CPU from them */
+void bench_wait_for( atomic_long *counter, long target ) {
+  while ( atomic_load( counter ) < target ) {
+    sched_yield();
+  }
+}
+
+/* ---- fifo: P producers, C consumers, every item pushed once and popped once ---- */
+
+static long fifo_sentinel = 0;
+
+typedef struct {
+  fifo_t *fifo;
+  long *stamps; // producers: their own range of items; push times, for sampled items
+  long count;
+  bench_samples_t *samples;
+} bench_fifo_thread_t;
+
+void *bench_fifo_producer( void *arg ) {
+  bench_fifo_thread_t *thread = (bench_fifo_thread_t*) arg;
+  long i = 0;
+  for ( i = 0; i < thread->count; i++ ) {
+    if ( !(i & (BENCH_SAMPLE_EVERY - 1)) ) {
+      thread->stamps[i] = bench_now_ns();
+    }
+    fifo_push( thread->fifo, &thread->stamps[i] );
+  }
+  return NULL;
+}
+
+/* Samples push-to-pop latency, of the items their producer stamped */
+void *bench_fifo_consumer( void *arg ) {
+  bench_fifo_thread_t *thread = (bench_fifo_thread_t*) arg;
+  long *item = NULL;
+  while ( (item = (long*) fifo_pop( thread->fifo )) != &fifo_sentinel ) {
+    if ( *item ) {
+      bench_samples_add( thread->samples, bench_now_ns() - *item );
+    }
+  }
+  return NULL;
+}
+
+void bench_fifo_run( long ops, int producers, int consumers ) {
+  fifo_t *fifo = fifo_create( "bench", 0 );
+  long *stamps = (long*) calloc( ops, sizeof(long) );
+  pthread_t threads[producers + consumers];
+  bench_fifo_thread_t args[producers + consumers];
+  long per_producer = ops / producers;
+  int i = 0;
+  long start = bench_now_ns();
+  for ( i = 0; i < consumers; i++ ) {
+    args[i].fifo = fifo;
+    args[i].samples = bench_samples_create( ops / BENCH_SAMPLE_EVERY + producers );
+    pthread_create( &threads[i], NULL, &bench_fifo_consumer, &args[i] );
+  }
+  for ( i = 0; i < producers; i++ ) {
+    bench_fifo_thread_t *arg = &args[consumers + i];
+    arg->fifo = fifo;
+    arg->stamps = stamps + i * per_producer;
+    arg->count = per_producer;
+    pthread_create( &threads[consumers + i], NULL, &bench_fifo_producer, arg );
+  }
+  for ( i = 0; i < producers; i++ ) {
+    pthread_join( threads[consumers + i], NULL );
+  }
+  for ( i = 0; i < consumers; i++ ) {
+    fifo_push( fifo, &fifo_sentinel );
+  }
+  bench_samples_t *samples = bench_samples_create( ops / BENCH_SAMPLE_EVERY + producers );
+  for ( i = 0; i < consumers; i++ ) {
+    pthread_join( threads[i], NULL );
+    bench_samples_merge( samples, args[i].samples );
+    bench_samples_destroy( args[i].samples );
+  }
+  long elapsed = bench_now_ns() - start;
+
+  char params[64];
+  snprintf( params, sizeof(params), "\"producers\":%i,\"consumers\":%i", producers, consumers );
+  bench_report( "fifo", params, per_producer * producers, elapsed, samples );
+  bench_samples_destroy( samples );
+  free( stamps );
+  fifo_destroy( fifo );
+}
+
+void bench_fifo( bench_options_t *options ) {
+  int producers = 1;
+  for ( producers = 1; producers <= options->max_threads; producers = bench_next_threads( producers, options->max_threads ) ) {
+    int consumers = 1;
+    for ( consumers = 1; consumers <= options->max_threads; consumers = bench_next_threads( consumers, options->max_threads ) ) {
+      bench_fifo_run( options->ops, producers, consumers );
+    }
+  }
+}
+
+/* ---- thread_pool: enqueue-to-run latency and task throughput ---- */
+
+typedef struct {
+  thread_pool_t *pool;
+  long *stamps; // enqueue times of sampled tasks, replaced by their latency once run
+  atomic_long done;
+} bench_pool_run_t;
+
+typedef struct {
+  bench_pool_run_t *run;
+  long first;
+  long count;
+} bench_pool_source_t;
+
+/* the task's arg is its stamp slot; the run is found through the pool's sole user */
+static bench_pool_run_t *pool_run = NULL;
+
+void *bench_pool_task( void *arg ) {
+  long *stamp = (long*) arg;
+  if ( *stamp ) {
+    *stamp = bench_now_ns() - *stamp;
+  }
+  atomic_fetch_add_explicit( &pool_run->done, 1, memory_order_release );
+  return NULL;
+}
+
+void bench_pool_enqueue_range( bench_pool_run_t *run, long first, long count ) {
+  long i = 0;
+  for ( i = first; i < first + count; i++ ) {
+    if ( !(i & (BENCH_SAMPLE_EVERY - 1)) ) {
+      run->stamps[i] = bench_now_ns();
+    }
+    thread_pool_enqueue( run->pool, &bench_pool_task, &run->stamps[i] );
+  }
+}
+
+/* Enqueues from inside the pool: in work-stealing mode that's the worker's own deque */
+void *bench_pool_source_task( void *arg ) {
+  bench_pool_source_t *source = (bench_pool_source_t*) arg;
+  bench_pool_enqueue_range( source->run, source->first, source->count );
+  return NULL;
+}
+
+void bench_thread_pool_run( long ops, int threads, thread_pool_mode_t mode, int from_workers ) {
+  bench_pool_run_t run;
+  run.pool = thread_pool_create_mode( "bench", threads, mode );
+  run.stamps = (long*) calloc( ops, sizeof(long) );
+  atomic_init( &run.done, 0 );
+  pool_run = &run;
+  bench_pool_source_t sources[threads];
+
+  long start = bench_now_ns();
+  if ( from_workers ) {
+    int i = 0;
+    long per_source = ops / threads;
+    for ( i = 0; i < threads; i++ ) {
+      sources[i].run = &run;
+      sources[i].first = i * per_source;
+      sources[i].count = i == threads - 1 ? ops - i * per_source : per_source;
+      thread_pool_enqueue( run.pool, &bench_pool_source_task, &sources[i] );
+    }
+  } else {
+    bench_pool_enqueue_range( &run, 0, ops );
+  }
+  bench_wait_for( &run.done, ops );
+  long elapsed = bench_now_ns() - start;
+
+  bench_samples_t *samples = bench_samples_create( ops / BENCH_SAMPLE_EVERY + 1 );
+  long i = 0;
+  for ( i = 0; i < ops; i += BENCH_SAMPLE_EVERY ) {
+    bench_samples_add( samples, run.stamps[i] );
+  }
+  char params[96];
+  snprintf( params, sizeof(params), "\"mode\":\"%s\",\"source\":\"%s\",\"threads\":%i",
+      mode == THREAD_POOL_WORK_STEALING ? "work_stealing" : "shared", from_workers ? "worker" : "external", threads );
+  bench_report( "thread_pool", params, ops, elapsed, samples );
+  bench_samples_destroy( samples );
+
+  thread_pool_exit_all( run.pool );
+  thread_pool_join_all( run.pool );
+  thread_pool_destroy( run.pool );
+  free( run.stamps );
+  pool_run = NULL;
+}
+
+void bench_thread_pool( bench_options_t *options ) {
+  thread_pool_mode_t modes[] = { THREAD_POOL_SHARED, THREAD_POOL_WORK_STEALING };
+  int m = 0;
+  for ( m = 0; m < 2; m++ ) {
+    int threads = 1;
+    for ( threads = 1; threads <= options->max_threads; threads = bench_next_threads( threads, options->max_threads ) ) {
+      bench_thread_pool_run( options->ops, threads, modes[m], 0 );
+      bench_thread_pool_run( options->ops, threads, modes[m], 1 );
+    }
+  }
+}
+
+/* ---- promise: the local cost, and a handoff between threads ---- */
+
+void *bench_promise_setter( void *arg ) {
+  promise_t *promise = (promise_t*) arg;
+  promise_set( promise, promise );
+  promise_destroy( promise );
+  return NULL;
+}
+
+void bench_promise( bench_options_t *options ) {
+  long ops = options->ops;
+  bench_samples_t *samples = bench_samples_create( ops / BENCH_SAMPLE_EVERY + 1 );
+  long i = 0;
+  long start = bench_now_ns();
+  for ( i = 0; i < ops; i++ ) {
+    long sampled = !(i & (BENCH_SAMPLE_EVERY - 1)) ? bench_now_ns() : 0;
+    promise_t *promise = promise_create();
+    promise_set( promise, promise );
+    promise_get( promise );
+    if ( sampled ) {
+      bench_samples_add( samples, bench_now_ns() - sampled );
+    }
+  }
+  bench_report( "promise", "\"path\":\"create_set_get\"", ops, bench_now_ns() - start, samples );
+  bench_samples_destroy( samples );
+
+  /* every round blocks in promise_get() until a worker sets it: a futex round trip */
+  long rounds = ops / 100 > 0 ? ops / 100 : 1;
+  thread_pool_t *pool = thread_pool_create( "bench", 1 );
+  samples = bench_samples_create( rounds );
+  start = bench_now_ns();
+  for ( i = 0; i < rounds; i++ ) {
+    long sent = bench_now_ns();
+    promise_t *promise = promise_create();
+    thread_pool_enqueue( pool, &bench_promise_setter, promise_retain( promise ) );
+    promise_get( promise );
+    bench_samples_add( samples, bench_now_ns() - sent );
+  }
+  bench_report( "promise", "\"path\":\"handoff\"", rounds, bench_now_ns() - start, samples );
+  bench_samples_destroy( samples );
+  thread_pool_exit_all( pool );
+  thread_pool_join_all( pool );
+  thread_pool_destroy( pool );
+}
+
+/* ---- message pool: get/put, from outside the pool and from its workers ---- */
+
+typedef struct {
+  actor_system_t *actor_system;
+  long count;
+  bench_samples_t *samples;
+  atomic_long *done;
+} bench_message_source_t;
+
+long bench_message_loop( actor_system_t *actor_system, long count, bench_samples_t *samples ) {
+  long i = 0;
+  for ( i = 0; i < count; i++ ) {
+    long sampled = !(i & (BENCH_SAMPLE_EVERY - 1)) ? bench_now_ns() : 0;
+    message_t *message = actor_system_message_get( actor_system, NULL, 0, NULL );
+    actor_system_message_put( actor_system, message );
+    if ( sampled ) {
+      bench_samples_add( samples, bench_now_ns() - sampled );
+    }
+  }
+  return count;
+}
+
+void *bench_message_task( void *arg ) {
+  bench_message_source_t *source = (bench_message_source_t*) arg;
+  bench_message_loop( source->actor_system, source->count, source->samples );
+  atomic_fetch_add( source->done, 1 );
+  return NULL;
+}
+
+void bench_message_pool_run( long ops, int threads ) {
+  actor_system_config_t config;
+  actor_system_config_init( &config );
+  config.thread_count = threads;
+  actor_system_t *actor_system = actor_system_create_with_config( "bench", &config );
+  char params[64];
+
+  /* outside of the pool, every get and put goes through the shared pool's lock */
+  bench_samples_t *samples = bench_samples_create( ops / BENCH_SAMPLE_EVERY + 1 );
+  long start = bench_now_ns();
+  bench_message_loop( actor_system, ops, samples );
+  snprintf( params, sizeof(params), "\"source\":\"external\",\"threads\":%i", threads );
+  bench_report( "message_pool", params, ops, bench_now_ns() - start, samples );
+  bench_samples_destroy( samples );
+
+  /* every worker at once, each through its own cache */
+  atomic_long done = 0;
+  bench_message_source_t sources[threads];
+  long per_worker = ops / threads;
+  int i = 0;
+  start = bench_now_ns();
+  for ( i = 0; i < threads; i++ ) {
+    sources[i].actor_system = actor_system;
+    sources[i].count = per_worker;
+    sources[i].samples = bench_samples_create( per_worker / BENCH_SAMPLE_EVERY + 1 );
+    sources[i].done = &done;
+    thread_pool_enqueue( actor_system->thread_pool, &bench_message_task, &sources[i] );
+  }
+  bench_wait_for( &done, threads );
+  long elapsed = bench_now_ns() - start;
+  samples = bench_samples_create( ops / BENCH_SAMPLE_EVERY + threads );
+  for ( i = 0; i < threads; i++ ) {
+    bench_samples_merge( samples, sources[i].samples );
+    bench_samples_destroy( sources[i].samples );
+  }
+  snprintf( params, sizeof(params), "\"source\":\"workers\",\"threads\":%i", threads );
+  bench_report( "message_pool", params, per_worker * threads, elapsed, samples );
+  bench_samples_destroy( samples );
+
+  actor_system_stop( actor_system );
+  thread_pool_join_all( actor_system->thread_pool );
+  actor_system_destroy( actor_system );
+}
+
+void bench_message_pool( bench_options_t *options ) {
+  int threads = 1;
+  for ( threads = 1; threads <= options->max_threads; threads = bench_next_threads( threads, options->max_threads ) ) {
+    bench_message_pool_run( options->ops, threads );
+  }
+}
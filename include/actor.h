@@ -1,13 +1,22 @@
 #ifndef _MELON_ACTOR_H_
 #define _MELON_ACTOR_H_
 
+#include <stdatomic.h>
+#include <stddef.h>
 
+#include "mailbox.h"
 #include "promise.h"
 #include "thread_pool.h"
 #include "message.h"
 #include "actor_system.h"
 
 typedef struct actor_t actor_t;
+typedef struct actor_group_t actor_group_t;
+typedef struct actor_stats_t actor_stats_t;
+
+/* The mailbox sojourn histogram (enqueue to dequeue): bucket 0 counts waits
+   under 1 usec, bucket i those under 2^i usec, and the last one the rest. */
+#define ACTOR_SOJOURN_BUCKETS 16
 
 typedef enum {
   ACTOR_DORMANT = 0,
@@ -23,23 +32,79 @@ typedef enum {
 typedef promise_t*(*receive_func_p)(actor_t*, message_t*);
 
 struct actor_t {
-  unsigned long pid;
+  unsigned long pid; // unique within the actor system, from actor_system_add(); 0 before
   const char *name;
-  actor_state_t state;
-  actor_livestate_t livestate;
+  _Atomic actor_state_t state;         // written by actor_spawn()/actor_kill(), read by every sender
+  _Atomic actor_livestate_t livestate; // ACTOR_AWAKE while a receive task runs
+  atomic_int scheduled; // 1 while a receive task is queued or running for this actor
+  int throughput;       // max messages per scheduling, 0 -> actor system default
+  long throughput_usec; // max time per scheduling, 0 -> actor system default
+  int worker;           // thread_pool worker that last ran us, -1 before; scheduling prefers it
+  atomic_long migrations; // times we ran on a different worker than the time before
   actor_system_t *actor_system;
-  fifo_t *mailbox;
+  mailbox_t *mailbox;
+  mailbox_t *control;   // MESSAGE_PRIORITY messages: received before anything in 'mailbox'
   receive_func_p receive;
+  void (*cleanup)(void*); // from actor_kill(), applied to messages left in the mailbox
+  /* statistics (see actor_stats()): senders bump 'enqueued', and only the
+     holder of 'scheduled' writes the rest */
+  atomic_long enqueued;
+  atomic_long received;
+  atomic_long depth_max;    // deepest the mailboxes were when a message was taken out
+  atomic_long receive_usec; // time spent in receive
+  atomic_long sojourn[ACTOR_SOJOURN_BUCKETS];
+  /* actor_registry_t chains, while the actor is in an actor system */
+  actor_t *pid_next;
+  actor_t **pid_pprev;
+  actor_t *name_next;
+  actor_t **name_pprev;
+  /* the actor system's list of removed actors, until one of us is destroyed */
+  actor_t *retired_next;
+  actor_t **retired_pprev;
+};
+
+/* A snapshot of one actor's counters. The timings stay 0 unless the actor
+   system's 'stats_timing' is on. */
+struct actor_stats_t {
+  unsigned long pid;
+  const char *name;
+  long received;
+  long depth;     // messages waiting in the mailboxes
+  long depth_max;
+  long receive_usec;
+  long migrations;
+  long sojourn[ACTOR_SOJOURN_BUCKETS];
 };
 
 // These message utils are a facade over actor_system_message_get/put
 message_t *actor_message_create( actor_t *actor, void *data, int type );
+message_t *actor_message_create_copy( actor_t *actor, const void *payload, size_t size, int type );
 void actor_message_destroy( actor_t *actor, message_t *message );
 
 actor_t *actor_create( receive_func_p receive, const char *name);
 void actor_spawn(actor_t *actor);
 void actor_kill( actor_t *actor, void(*cleanup)(void*) );
+/* The caller owns the returned promise: promise_get() it, promise_destroy() it,
+   or hand it on (return it from receive, promise_then(), actor_pipe()) */
 promise_t *actor_send( actor_t *actor, message_t *message);
+/* Send without a promise, for one-way traffic */
+void actor_tell( actor_t *actor, message_t *message );
+/* actor_tell() a burst of messages, with one mailbox operation and one scheduling */
+void actor_send_batch( actor_t *actor, message_t **messages, long count );
+/* Tell every actor in the group, sharing one copy of the payload */
+void actor_broadcast( actor_group_t *group, int type, const void *payload, size_t size );
+/* From receive: pass the message, and the sender's promise, on to another actor */
+void actor_forward( actor_t *actor, message_t *message );
 void actor_destroy( actor_t *actor );
+/* Next message, control lane first, or NULL: for the receive loop and teardown */
+mailbox_node_t *actor_mailbox_pop_internal( actor_t *actor );
+/* Send 'message' to 'actor', with the promise's value as its data, once it resolves */
+void actor_pipe( promise_t *promise, actor_t *actor, message_t *message );
+
+/* Read the actor's counters, while it runs */
+void actor_stats( actor_t *actor, actor_stats_t *stats );
+
+/* Override the actor system's throughput quantum for this actor. 0 means 'use the default'. */
+void actor_set_throughput( actor_t *actor, int messages, long usec );
 
 #endif // _MELON_ACTOR_H_
@@ -0,0 +1,32 @@
+#ifndef _MELON_ACTOR_GROUP_H_
+#define _MELON_ACTOR_GROUP_H_
+
+#include "actor.h"
+#include "threads.h"
+
+typedef struct actor_t actor_t;
+typedef struct actor_system_t actor_system_t;
+typedef struct actor_group_t actor_group_t;
+
+/*
+ - actor_group_t
+   A named set of actors in one actor system, to actor_broadcast() to.
+   Groups belong to their actor system, and are destroyed along with it.
+   An actor should leave its groups before it is destroyed.
+*/
+struct actor_group_t {
+  const char *name;
+  actor_system_t *actor_system;
+  actor_t **members;
+  long count;
+  long capacity;
+  pthread_mutex_t *mutex;
+};
+
+actor_group_t *actor_group_create( actor_system_t *actor_system, const char *name );
+void actor_group_add( actor_group_t *group, actor_t *actor );
+void actor_group_remove( actor_group_t *group, actor_t *actor );
+long actor_group_count( actor_group_t *group );
+void actor_group_destroy( actor_group_t *group );
+
+#endif // _MELON_ACTOR_GROUP_H_
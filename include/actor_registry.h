@@ -0,0 +1,40 @@
+#ifndef _MELON_ACTOR_REGISTRY_H_
+#define _MELON_ACTOR_REGISTRY_H_
+
+#include "threads.h"
+
+typedef struct actor_t actor_t;
+typedef struct actor_registry_t actor_registry_t;
+
+#define ACTOR_REGISTRY_INITIAL_BUCKETS 64
+
+/*
+ - actor_registry_t
+   The actors of one actor system, hashed twice: by pid and by name. Both
+   indexes are chained through links in actor_t itself, doubly so that an
+   actor can unlink itself without a search, which keeps insert, remove and
+   lookup O(1) on average. The table doubles once it holds more actors than
+   buckets. Names needn't be unique; a name lookup finds the newest.
+*/
+struct actor_registry_t {
+  actor_t **by_pid;
+  actor_t **by_name;
+  long buckets; // a power of 2, for both indexes
+  long count;
+  pthread_mutex_t *mutex;
+};
+
+actor_registry_t *actor_registry_create();
+void actor_registry_insert( actor_registry_t *registry, actor_t *actor );
+/* returns 0 if the actor wasn't registered */
+int  actor_registry_remove( actor_registry_t *registry, actor_t *actor );
+actor_t *actor_registry_find( actor_registry_t *registry, unsigned long pid );
+actor_t *actor_registry_find_name( actor_registry_t *registry, const char *name );
+long actor_registry_count( actor_registry_t *registry );
+/* func may remove, or destroy, the actor it's given */
+void actor_registry_each( actor_registry_t *registry, void(*func)(actor_t*) );
+/* the same, passing 'arg' along */
+void actor_registry_each_arg( actor_registry_t *registry, void(*func)(actor_t*, void*), void *arg );
+void actor_registry_destroy( actor_registry_t *registry );
+
+#endif // _MELON_ACTOR_REGISTRY_H_
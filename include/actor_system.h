@@ -1,14 +1,16 @@
 #ifndef _MELON_ACTOR_SYSTEM_H_
 #define _MELON_ACTOR_SYSTEM_H_
 
+#include <stdatomic.h>
+
 #include "actor.h"
+#include "actor_registry.h"
 #include "fifo.h"
 #include "thread_pool.h"
 
 /***
 * TODO:
 * - allow manual purging of the message pool (memory utilization/fragmentation)
-* - block allocation at startup; initialize with a pool of a certain size
 void actor_system_clear_messages( actor_system_t *actor_system );
 */
 
@@ -16,6 +18,47 @@ void actor_system_clear_messages( actor_system_t *actor_system );
 typedef struct actor_t actor_t;
 typedef struct message_t message_t;
 typedef struct actor_system_t actor_system_t;
+typedef struct actor_stats_t actor_stats_t;
+
+/* How many messages (or microseconds, if non-zero) an actor may consume in
+   one scheduling before it yields its worker back to the thread pool */
+#define ACTOR_SYSTEM_DEFAULT_THROUGHPUT 64
+#define ACTOR_SYSTEM_DEFAULT_THROUGHPUT_USEC 0
+#define ACTOR_SYSTEM_DEFAULT_THREADS 0 // one per usable CPU
+#define ACTOR_SYSTEM_DEFAULT_MESSAGE_CAPACITY 1024
+#define ACTOR_SYSTEM_DEFAULT_MESSAGE_INLINE 64
+
+typedef struct actor_system_config_t actor_system_config_t;
+typedef struct actor_system_stats_t actor_system_stats_t;
+typedef struct message_cache_t message_cache_t;
+
+/* Each worker keeps recycled messages to itself, and only goes to the shared
+   pool, under its lock, to move MESSAGE_CACHE_BATCH of them at a time. */
+#define MESSAGE_CACHE_BATCH 32
+#define MESSAGE_CACHE_MAX (2 * MESSAGE_CACHE_BATCH)
+
+struct message_cache_t {
+  _Alignas(64) message_t *head;
+  atomic_long count;     // written by the worker only, read by actor_system_stats()
+  atomic_long allocated; // messages this worker had to malloc
+};
+
+/*
+ - actor_system_config_t
+   Knobs for actor_system_create_with_config(). Start from actor_system_config_init()
+   and override what you need; actor_system_create() uses the defaults as-is.
+*/
+struct actor_system_config_t {
+  int thread_count;      // 0: one worker per CPU we may use, per dna_cpu_count()
+  int pin_workers;       // bind each worker to its own CPU
+  thread_pool_mode_t scheduler;
+  int throughput;
+  long throughput_usec;
+  long message_capacity; // messages carved from one arena at startup, 0 for none
+  int huge_pages;        // try to back the message arena with huge pages
+  long message_inline;   // payload bytes every message can hold without a malloc
+  int stats_timing;      // time receives and mailbox sojourns: a few clock reads per message
+};
 
 /*
  - actor_system_t
@@ -23,17 +66,61 @@ typedef struct actor_system_t actor_system_t;
 */
 struct actor_system_t {
   const char *name;
-  fifo_t *actors;
-  fifo_t *message_pool;
+  actor_registry_t *actors;
+  atomic_ulong next_pid;
+  fifo_t *groups;                  // actor_group_t's created in this system
+  /* Removed (e.g. killed) actors that haven't been destroyed yet: their
+     mailboxes may still hold arena messages, which we drain before unmapping */
+  actor_t *retired;
+  pthread_mutex_t *retired_mutex;
+  message_t *message_pool; // shared free list, under message_pool_mutex
+  long message_pool_size;
+  pthread_mutex_t *message_pool_mutex;
+  message_cache_t *message_caches; // one per thread_pool worker
+  void *message_arena;             // message_capacity messages, one or more cache lines each
+  size_t message_arena_size;       // bytes mapped
+  long message_capacity;
+  long message_inline;             // payload_capacity of every message we create
+  atomic_long message_allocs;      // messages malloc'd outside of any worker
+  int stats_timing;
   thread_pool_t *thread_pool;
+  int throughput;
+  long throughput_usec;
+};
+
+/*
+ - actor_system_stats_t
+   A snapshot from actor_system_stats(), taken while everything keeps running:
+   every counter is read as it stands, so they needn't add up exactly.
+*/
+struct actor_system_stats_t {
+  long message_pool;     // recycled messages ready for reuse, shared pool and worker caches
+  long message_capacity; // messages carved from the arena
+  long message_allocs;   // messages malloc'd once the pool ran dry
+  long promises_created; // process-wide, see promise_counts()
+  long promises_live;
+  int worker_count;
+  thread_pool_worker_stats_t *workers;
+  long actor_count;
+  actor_stats_t *actors;
 };
 
+void actor_system_config_init( actor_system_config_t *config );
 actor_system_t *actor_system_create(const char *name);
+actor_system_t *actor_system_create_with_config( const char *name, const actor_system_config_t *config );
 void actor_system_add( actor_system_t *actor_system, actor_t *actor );
 void actor_system_remove( actor_system_t *actor_system, actor_t *actor );
+/* used by actor_destroy(): take the actor off the retired list, if it's on it */
+void actor_system_forget_internal( actor_system_t *actor_system, actor_t *actor );
+/* NULL if no such actor is in the system (any more) */
+actor_t *actor_system_lookup( actor_system_t *actor_system, unsigned long pid );
+actor_t *actor_system_lookup_name( actor_system_t *actor_system, const char *name );
 void actor_system_run( actor_system_t *actor_system );
 void actor_system_stop( actor_system_t * actor_system );
 void actor_system_destroy( actor_system_t *actor_system );
+void actor_system_set_throughput( actor_system_t *actor_system, int messages, long usec );
+actor_system_stats_t *actor_system_stats( actor_system_t *actor_system );
+void actor_system_stats_destroy( actor_system_stats_t *stats );
 
 message_t *actor_system_message_get( actor_system_t *actor_system, void *data, int type, actor_t *from );
 void actor_system_recycle_messages( actor_system_t *actor_system, fifo_t *message_fifo );
@@ -0,0 +1,39 @@
+#ifndef _MELON_DEQUE_H_
+#define _MELON_DEQUE_H_
+
+#include <stdatomic.h>
+
+/***
+* deque_t: a lock-free work-stealing deque (Chase-Lev, with the C11 memory
+* orderings from Le, Pop, Cohen & Zappa Nardelli, PPoPP 2013).
+*
+* - The owning thread pushes and pops at the bottom, LIFO, without contention.
+* - Any other thread may steal from the top, FIFO, with a single CAS.
+* - The ring grows as needed. Retired rings are kept until deque_destroy(),
+*   because a thief may still be reading from one.
+* - NULL can't be stored: pop and steal use it to mean "nothing for you".
+*/
+
+typedef struct deque_array_t deque_array_t;
+typedef struct deque_t deque_t;
+
+struct deque_array_t {
+  long capacity;
+  deque_array_t *retired; // previous, smaller ring
+  _Atomic(void*) items[];
+};
+
+struct deque_t {
+  _Alignas(64) atomic_long top;
+  _Alignas(64) atomic_long bottom;
+  _Atomic(deque_array_t*) array;
+};
+
+deque_t *deque_create( long capacity );
+void deque_push( deque_t *deque, void *item );
+void *deque_pop( deque_t *deque );
+void *deque_steal( deque_t *deque );
+long deque_count( deque_t *deque );
+void deque_destroy( deque_t *deque );
+
+#endif // _MELON_DEQUE_H_
@@ -4,25 +4,33 @@
 #include <pthread.h>
 
 typedef struct node_t node_t;
+typedef struct node_chunk_t node_chunk_t;
 typedef struct fifo_t fifo_t;
 
 struct node_t {
   node_t *next;
   void * data;
+  int cached; // carved from the fifo's node slab; goes back to node_cache, never free()'d
 };
 
 struct fifo_t {
   const char *name;
   long size;
+  long max_size; // <= 0 : unbounded
+
   node_t *first;
   node_t *current;
   pthread_cond_t *wait_pop;
-  pthread_cond_t *wait_push;
+  pthread_cond_t *wait_push; // waiting for room in a bounded fifo
   pthread_mutex_t *mutex;
-  node_t *node_cache;
+  node_t *node_cache;        // released nodes, ready for the next push
+  node_chunk_t *node_chunks; // the slab node_cache is carved from
+  long node_cache_size;      // nodes carved so far
+  long node_cache_max;
 };
 
 void*fifo_pop( fifo_t *fifo );
+void*fifo_try_pop( fifo_t *fifo );
 //void*fifo_peek( fifo_t *fifo );
 //fifo_t *fifo_filter( fifo_t *fifo )
 //fifo_t *fifo_extract( fifo_t *fifo, int(*predicate)(const void*) );
@@ -33,6 +41,10 @@ int  fifo_is_empty( fifo_t *fifo );
 void fifo_destroy( fifo_t *fifo );
 long fifo_count( fifo_t *fifo );
 void fifo_push( fifo_t * fifo, void * item );
+int  fifo_try_push( fifo_t *fifo, void *item );
+int  fifo_push_timed( fifo_t *fifo, void *item, long timeout_usec );
+void fifo_push_n( fifo_t *fifo, void **items, long count );
+/* max_size > 0 bounds the fifo: pushes block (or fail, see above) while it is full */
 fifo_t *fifo_create( const char *name, long max_size );
 
 #endif // _MELON_FIFO_H_
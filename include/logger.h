@@ -4,6 +4,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdarg.h>
+#include <stdatomic.h>
 
 enum log_level_t {
   NONE = 0,
@@ -15,8 +16,35 @@ enum log_level_t {
 };
 
 typedef enum log_level_t log_level_t;
-#define GLOBAL_LOG_LEVEL VERBOSE 
+/* the level until dna_log_set_level() says otherwise */
+#define GLOBAL_LOG_LEVEL INFO
 
-void dna_log( log_level_t level, const char *fmt, ... );
+/* longest log line kept, label excluded; longer ones are cut short */
+#define LOG_RECORD_SIZE 240
+/* records a thread can have waiting for the writer thread (a power of 2).
+   Once its ring is full, a thread's new records are dropped, and counted. */
+#define LOG_RING_SIZE 1024
+
+/***
+* Logging is asynchronous. dna_log() formats the line into the calling thread's
+* own ring buffer, lock-free and without allocating, and a background thread
+* labels the records and writes them out in batches. A level that's switched
+* off costs one load and one branch, and its arguments are never evaluated.
+*/
+extern atomic_int dna_log_threshold;
+
+#define dna_log( level, ... ) do { \
+    if ( (int) (level) <= atomic_load_explicit( &dna_log_threshold, memory_order_relaxed ) ) { \
+      dna_log_write( (level), __VA_ARGS__ ); \
+    } \
+  } while ( 0 )
+
+void dna_log_write( log_level_t level, const char *fmt, ... );
+void dna_log_set_level( log_level_t level );
+log_level_t dna_log_get_level();
+/* Write out everything logged so far, from every thread, before returning */
+void dna_log_flush();
+/* records lost to full rings, since the start */
+unsigned long dna_log_dropped();
 
 #endif // _MELON_LOGGING_H_
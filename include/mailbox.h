@@ -0,0 +1,42 @@
+#ifndef _MELON_MAILBOX_H_
+#define _MELON_MAILBOX_H_
+
+#include <stdatomic.h>
+
+/***
+* mailbox_t: an intrusive, lock-free, multi-producer single-consumer queue
+* (Dmitry Vyukov's MPSC node queue).
+*
+* - Any thread may push. Only one thread at a time may pop; for an actor
+*   that is whichever worker currently holds the actor's 'scheduled' flag.
+* - Nodes are embedded in the queued items (see message_t), so pushing
+*   never allocates.
+* - mailbox_pop() never blocks. It may return NULL while a producer is
+*   half-way through a push; mailbox_is_empty() still reports that
+*   mailbox as non-empty, so the consumer knows to come back.
+* - mailbox_is_empty() may be asked by anyone; from outside the consumer
+*   the answer can be stale, so only take 'non-empty' as a hint.
+*/
+
+typedef struct mailbox_node_t mailbox_node_t;
+typedef struct mailbox_t mailbox_t;
+
+struct mailbox_node_t {
+  mailbox_node_t *_Atomic next;
+};
+
+struct mailbox_t {
+  const char *name;
+  _Alignas(64) mailbox_node_t *_Atomic head; // producers swap themselves in here
+  _Alignas(64) mailbox_node_t *_Atomic tail; // consumer-owned, but see mailbox_is_empty()
+  mailbox_node_t stub;
+};
+
+mailbox_t *mailbox_create( const char *name );
+void mailbox_push( mailbox_t *mailbox, mailbox_node_t *node );
+void mailbox_push_chain( mailbox_t *mailbox, mailbox_node_t *first, mailbox_node_t *last );
+mailbox_node_t *mailbox_pop( mailbox_t *mailbox );
+int  mailbox_is_empty( mailbox_t *mailbox );
+void mailbox_destroy( mailbox_t *mailbox );
+
+#endif // _MELON_MAILBOX_H_
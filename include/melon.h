@@ -4,7 +4,9 @@
 #include "promise.h"
 #include "actor.h"
 #include "actor_system.h"
+#include "actor_group.h"
 #include "fifo.h"
 #include "thread_pool.h"
+#include "trace.h"
 
 #endif // _MELON_H_
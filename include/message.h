@@ -1,21 +1,77 @@
 #ifndef _MELON_MESSAGE_H_
 #define _MELON_MESSAGE_H_
 
+#include <stddef.h>
+#include <stdatomic.h>
+
 #include "actor.h"
+#include "mailbox.h"
 #include "promise.h"
 
 typedef struct actor_t actor_t;
 typedef struct message_t message_t;
 
+/* message_t.flags */
+#define MESSAGE_FROM_ARENA 0x1 // carved from an actor system's arena: never free()'d
+#define MESSAGE_OWNS_DATA 0x2  // 'data' is a malloc'd copy, freed along with the message
+#define MESSAGE_SHARED_DATA 0x4 // 'data' is a message_shared_t's, released along with the message
+#define MESSAGE_PRIORITY 0x8    // goes through the receiver's control lane, ahead of other messages
+
+typedef struct message_shared_t message_shared_t;
+
+/*
+ - message_shared_t
+   One copy of a payload for many messages, e.g. a broadcast: every message
+   holds a reference, and the last one recycled frees it.
+*/
+struct message_shared_t {
+  atomic_long refs;
+  size_t size;
+  _Alignas(16) unsigned char data[];
+};
+
+/*
+ - message_t
+   Small payloads are copied into the message itself, by message_set_payload(),
+   right behind the header: 'payload_capacity' bytes of it, as configured per
+   actor system. 'data' then points at 'payload', and nothing else needs to be
+   allocated or freed. Payloads that don't fit get a malloc'd copy instead.
+*/
 struct message_t {
+  mailbox_node_t node; // must stay first: mailbox nodes are cast back to messages
   int type; // map to user enum
+  unsigned int flags;
   unsigned long id;
   void *data;
   actor_t *from; // until I get some sleep, forward references are mystifying me with typedef struct members
   promise_t *promise;
+  union {
+    message_t *pool_next; // free list link while the message sits in a message pool
+    long queued_usec;     // when it went into a mailbox (0: untimed), for actor statistics
+  };
+  unsigned int payload_capacity;
+  unsigned int payload_size; // bytes copied in by message_set_payload()
+  _Alignas(16) unsigned char payload[];
 };
 
 message_t *message_create(void *data, int type, actor_t *from);
+message_t *message_create_sized(size_t payload_capacity, void *data, int type, actor_t *from);
+void message_init(message_t *message, void *data, int type, actor_t *from);
+/* Copy 'size' bytes in, inline if they fit, and point 'data' at the copy */
+void message_set_payload(message_t *message, const void *payload, size_t size);
+/* Free 'data' if the message owns it, or drop its reference if it's shared */
+void message_release_data(message_t *message);
+/* Hand whatever 'from' carries as data over to 'to', ownership included */
+void message_move_data(message_t *to, message_t *from);
+
+/* A shared payload starts with one reference, for its creator */
+message_shared_t *message_shared_create(const void *payload, size_t size);
+message_shared_t *message_shared_retain(message_shared_t *shared);
+void message_shared_release(message_shared_t *shared);
+/* Point 'data' at the shared payload; takes over a reference */
+void message_set_shared(message_t *message, message_shared_t *shared);
+/* Non-zero: jump the queue of ordinary messages at the receiver */
+void message_set_priority(message_t *message, int priority);
 void message_destroy(message_t *message);
 
 #endif // _MELON_MESSAGE_H_
@@ -1,29 +1,71 @@
 #ifndef _MELON_PROMISE_H_
 #define _MELON_PROMISE_H_
 
-#include "fifo.h"
+#include <stdatomic.h>
+
 //#define PROMISE_DEBUG
 // written on the toilet in 3 minutes or less
 typedef struct promise_t promise_t;
+typedef void(*promise_then_func_p)(void *resolution, void *arg);
 
 typedef enum {
   PROMISE_WAITING = 0,
   PROMISE_RESOLVED = 1,
-  PROMISE_COMPLETE = 2
+  PROMISE_COMPLETE = 2,
+  PROMISE_CHAINED = 3, // forwards its value to promise_t.next
+  PROMISE_SETTING = 4  // claimed by a set or chain that's filling it in: still waiting, to everyone else
 } promise_state_t;
 
+/* Or'd into promise_t.state while a thread sleeps on it in promise_get() */
+#define PROMISE_WAITERS 0x100
+/* Or'd into promise_t.state once promise_then() has left a continuation */
+#define PROMISE_THEN 0x200
+#define PROMISE_STATE_MASK 0xff
+
+/*
+ - promise_t
+   One allocation: the value lives inline, and 'state' doubles as the futex
+   word a blocked promise_get() sleeps on. Nobody touches the kernel unless
+   someone is actually waiting.
+
+   A promise is reference counted. promise_create() hands the caller one
+   reference; promise_get() and promise_destroy() each give one back, and
+   promise_chain() takes over the reference to the promise it links to.
+
+   Chains are flattened: promise_chain(p1, p2) points p2 straight at the
+   promise p1 would ultimately deliver to, so resolving the last link of a
+   long chain reaches the original waiter in one step, and every link in
+   between can be freed as soon as its message is done with it.
+
+   promise_then() is the non-blocking way to consume a promise: instead of
+   parking a thread, it leaves a continuation that runs once the value is in,
+   on the thread pool of whichever worker resolved it.
+*/
 struct promise_t {
   unsigned long id;
   void *resolution;
-  fifo_t *fifo;
-  promise_state_t state;
+  promise_t *next; // PROMISE_CHAINED: where our value goes (we hold a reference)
+  promise_then_func_p then; // continuation left by promise_then()
+  void *then_arg;
+  atomic_int state;
+  atomic_int refs;
 };
 
 promise_t *promise_create();
 promise_t *promise_resolved(void *resolved_value);
+promise_t *promise_retain( promise_t *promise );
+promise_state_t promise_state( promise_t *promise );
 void promise_set( promise_t *promise, void *val );
 void promise_chain( promise_t *promise1, promise_t *promise2 );
 void *promise_get( promise_t *promise );
+/* Run func(resolution, arg) once the promise resolves, instead of blocking for it.
+   If a pool worker resolves it, func is queued on that worker's pool; if the
+   promise has already resolved, or is resolved outside the pool, func runs
+   right there. One continuation per promise; like promise_get(), this takes
+   over the caller's reference. */
+void promise_then( promise_t *promise, promise_then_func_p func, void *arg );
 void promise_destroy( promise_t *promise );
+/* Process-wide: promises created so far, and how many of them are still allocated */
+void promise_counts( long *created, long *live );
 
 #endif // _MELON_PROMISE_H_
@@ -1,27 +1,93 @@
 #ifndef _MELON_THREAD_POOL_H_
 #define _MELON_THREAD_POOL_H_
 
+#include <stdatomic.h>
+
+#include "deque.h"
 #include "fifo.h"
 #include "threads.h"
 
+/* tasks handed to the pool at once by thread_pool_enqueue_n() */
+#define THREAD_POOL_BATCH 64
+/* An idle worker polls for work 'spin' times (adapted between these bounds),
+   then yields its CPU THREAD_POOL_YIELDS times, and only then parks. */
+#define THREAD_POOL_SPIN_MIN 16
+#define THREAD_POOL_SPIN_MAX 4096
+#define THREAD_POOL_YIELDS 8
+
 typedef struct thread_pool_t thread_pool_t;
+typedef struct thread_pool_worker_t thread_pool_worker_t;
+typedef struct thread_pool_worker_stats_t thread_pool_worker_stats_t;
+
+typedef enum {
+  THREAD_POOL_SHARED = 0,   // every worker pops from the one 'tasks' fifo, and its inbox
+  THREAD_POOL_WORK_STEALING // every worker owns a deque, idle workers steal
+} thread_pool_mode_t;
+
+struct thread_pool_worker_t {
+  thread_pool_t *pool;
+  int index;
+  dna_thread_context_t *context;
+  deque_t *deque;    // work-stealing only: tasks enqueued from this worker
+  fifo_t *inbox;     // tasks aimed at this worker (in work-stealing mode, by other threads)
+  unsigned int seed; // picks steal victims
+  int spin;          // idle polls before yielding, adapted as we go
+  /* statistics, written only by the worker itself (see thread_pool_worker_stats()) */
+  atomic_long tasks;
+  atomic_long steals;     // tasks taken from another worker's deque or inbox
+  atomic_long parks;
+  atomic_long idle_usec;  // closed stretches of idleness
+  atomic_long idle_since; // start of the current stretch, 0 while busy
+  long started_usec;
+};
+
+/* A snapshot of one worker's counters */
+struct thread_pool_worker_stats_t {
+  long tasks;
+  long steals;
+  long parks;
+  long busy_usec;
+  long idle_usec; // spinning, yielding or parked
+};
 
 struct thread_pool_t {
   const char *name;
-  fifo_t *tasks;
+  thread_pool_mode_t mode;
+  fifo_t *tasks; // in work-stealing mode, only tasks enqueued from outside the pool
   fifo_t *thread_queue;
   pthread_cond_t *wait;
   pthread_mutex_t *mutex;
+  int worker_count;
+  thread_pool_worker_t *workers;
+  /* parking for idle workers */
+  atomic_long pending;   // tasks enqueued and not yet picked up
+  atomic_int sleeping;   // workers parked on 'wake_seq'
+  atomic_int wake_seq;   // futex word: bumped to wake parked workers
+  atomic_int exiting;
 };
 
 /***
 * Create a thread pool, including a fifo of tasks.
 * Starts consuming tasks immediately.
+* A thread_count <= 0 means one worker per usable CPU (see dna_cpu_count()).
 */
 thread_pool_t *thread_pool_create( const char *name, int thread_count );
+thread_pool_t *thread_pool_create_mode( const char *name, int thread_count, thread_pool_mode_t mode );
+/* bind worker i to the i'th CPU we may use */
+void thread_pool_pin_workers( thread_pool_t *pool );
 void thread_pool_exit_all( thread_pool_t *pool );
 void thread_pool_join_all( thread_pool_t *pool );
 void thread_pool_destroy( thread_pool_t *pool );
 void thread_pool_enqueue( thread_pool_t *pool, void*(*func)(void*), void *arg );
+/* enqueue, preferably to run on worker 'index' (see thread_pool_worker_index()) */
+void thread_pool_enqueue_to( thread_pool_t *pool, int index, void*(*func)(void*), void *arg );
+/* enqueue func(args[i]) for each arg, as a batch */
+void thread_pool_enqueue_n( thread_pool_t *pool, void*(*func)(void*), void **args, long count );
+/* index of the calling thread among the pool's workers, or -1 if it isn't one */
+int thread_pool_worker_index( thread_pool_t *pool );
+/* the pool the calling thread works for, or NULL outside of any pool */
+thread_pool_t *thread_pool_current();
+/* read worker 'index's counters, while it runs */
+void thread_pool_worker_stats( thread_pool_t *pool, int index, thread_pool_worker_stats_t *stats );
 
 #endif // _MELON_THREAD_POOL_H_
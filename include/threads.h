@@ -2,6 +2,7 @@
 #define _MELON_THREADS_H_
 
 #include <pthread.h>
+#include <stdatomic.h>
 
 typedef struct dna_thread_context_t dna_thread_context_t;
 
@@ -32,7 +33,7 @@ void dna_mutex_lock( pthread_mutex_t *mutex );
 void dna_mutex_unlock( pthread_mutex_t *mutex );
 void dna_cond_init( pthread_cond_t *cond );
 void dna_cond_wait( pthread_cond_t *cond, pthread_mutex_t *mutex );
-void dna_cond_timedwait( pthread_cond_t *cond, pthread_mutex_t *mutex, const struct timespec *abstime  );
+int  dna_cond_timedwait( pthread_cond_t *cond, pthread_mutex_t *mutex, const struct timespec *abstime  );
 void dna_cond_signal( pthread_cond_t *cond );
 void dna_cond_broadcast( pthread_cond_t *cond );
 void dna_cond_destroy( pthread_cond_t *cond );
@@ -41,4 +42,26 @@ void dna_mutex_destroy ( pthread_mutex_t *mutex );
 void dna_thread_cancel( pthread_t *thread );
 void dna_thread_detach( pthread_t *thread );
 
+/* Sleep while *addr == expected, until someone calls dna_futex_wake() on it */
+void dna_futex_wait( atomic_int *addr, int expected );
+void dna_futex_wake( atomic_int *addr, int count );
+
+/* Add to a statistics counter that only one thread ever writes: a relaxed
+   load and store is enough, where an atomic add would lock the bus. Readers
+   see some recent value. */
+static inline void dna_count( atomic_long *counter, long n ) {
+  atomic_store_explicit( counter, atomic_load_explicit( counter, memory_order_relaxed ) + n, memory_order_relaxed );
+}
+
+/* pause inside a spin loop */
+void dna_cpu_relax();
+
+/* monotonic clock, in microseconds */
+long dna_time_usec();
+
+/* CPUs this process may use: the affinity mask, capped by a cgroup CPU quota */
+int dna_cpu_count();
+/* Bind a thread to one CPU, the slot'th (modulo) of those we may use; 0 on success */
+int dna_thread_pin( pthread_t *thread, int slot );
+
 #endif // _MELON_THREADS_H_
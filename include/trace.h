@@ -0,0 +1,71 @@
+#ifndef _MELON_TRACE_H_
+#define _MELON_TRACE_H_
+
+#include <stdatomic.h>
+
+/***
+* Event tracing, for finding out where a message's time went.
+*
+* Compiled in only with -D MELON_TRACE (cmake -D MELON_TRACE=ON); without it
+* the hooks below are empty. When compiled in, nothing is recorded until
+* dna_trace_start(), and a hook costs one load and one branch while stopped.
+*
+* Each thread records into its own ring of TRACE_BUFFER_SIZE events, so the
+* oldest events of a long window are overwritten. dna_trace_write() exports the
+* events of the last window as Chrome trace-event JSON, which chrome://tracing
+* and ui.perfetto.dev open. A message's enqueue and its receive are linked
+* by a flow arrow.
+*/
+
+/* events kept per thread (a power of 2) */
+#define TRACE_BUFFER_SIZE (1 << 15)
+
+typedef enum {
+  TRACE_ENQUEUE = 0, // a message went into an actor's mailbox
+  TRACE_DEQUEUE,     // the actor's receive loop took it out
+  TRACE_RECEIVE,     // span: the actor's receive function ran on it
+  TRACE_RESOLVE,     // a promise was resolved
+  TRACE_PARK,        // span: a worker slept on the futex, until woken
+  TRACE_EVENT_TYPES
+} trace_event_type_t;
+
+extern atomic_int dna_trace_on;
+
+#ifdef MELON_TRACE
+#define dna_trace_active() atomic_load_explicit( &dna_trace_on, memory_order_relaxed )
+/* an instant event; 'flow' ties an enqueue to its receive (0 for none) */
+#define dna_trace( type, flow, actor, arg ) do { \
+    if ( dna_trace_active() ) { \
+      dna_trace_event( (type), 0, (flow), (actor), (arg) ); \
+    } \
+  } while ( 0 )
+/* where a span starts: 0 while tracing is stopped */
+#define dna_trace_clock() ( dna_trace_active() ? dna_trace_now() : 0L )
+/* a span from 'start', a dna_trace_clock(), until now */
+#define dna_trace_span( type, start, flow, actor, arg ) do { \
+    if ( (start) ) { \
+      dna_trace_event( (type), (start), (flow), (actor), (arg) ); \
+    } \
+  } while ( 0 )
+#else
+#define dna_trace_active() 0
+/* sizeof() keeps locals that only feed the hooks "used", without evaluating them */
+#define dna_trace( type, flow, actor, arg ) do { (void) sizeof( (flow) + (actor) + (arg) ); } while ( 0 )
+#define dna_trace_clock() 0L
+#define dna_trace_span( type, start, flow, actor, arg ) do { (void) sizeof( (start) + (flow) + (actor) + (arg) ); } while ( 0 )
+#endif
+
+/* Open a window: events from now on are recorded. */
+void dna_trace_start();
+/* Close it: nothing more is recorded until the next dna_trace_start(). */
+void dna_trace_stop();
+/* Export the last window as JSON; 0 on success. Call it once stopped. */
+int  dna_trace_write( const char *path );
+/* Name the calling thread in exported traces, e.g. "pool/3" */
+void dna_trace_name_thread( const char *name, int index );
+
+/* used by the macros above */
+long dna_trace_now();
+void dna_trace_event( trace_event_type_t type, long start, unsigned long flow, unsigned long actor, unsigned long arg );
+
+#endif // _MELON_TRACE_H_
@@ -3,11 +3,16 @@
 #include <string.h>
 
 #include "fifo.h"
+#include "mailbox.h"
 #include "promise.h"
 #include "message.h"
 #include "actor.h"
 #include "actor_system.h"
+#include "actor_group.h"
+#include "actor_registry.h"
 #include "logger.h"
+#include "threads.h"
+#include "trace.h"
 
 /* We MIGHT create a message, or recycle an old one. See actor_system_message_get()/.._put() */
 message_t *actor_message_create( actor_t *actor, void *data, int type ) {
@@ -17,13 +22,18 @@ message_t *actor_message_create( actor_t *actor, void *data, int type ) {
   return NULL;
 }
 
+/* Same, with a copy of 'size' bytes of payload as its data: inline in the
+   message when it fits, or a malloc'd copy the message frees when recycled */
+message_t *actor_message_create_copy( actor_t *actor, const void *payload, size_t size, int type ) {
+  message_t *message = actor_message_create( actor, NULL, type );
+  if ( message ) {
+    message_set_payload( message, payload, size );
+  }
+  return message;
+}
+
 /* perhaps a better name is due - it doesn't destroy, but recycles it */
 void actor_message_destroy( actor_t *actor, message_t *message ) {
-  message->data = NULL;
-  if (message->promise) {
-    promise_destroy( message->promise );
-  }
-  message->promise = NULL;
   message->id = 0;
   message->from = NULL;
   message->type = 0;
@@ -34,113 +44,291 @@ actor_t *actor_create( receive_func_p receive, const char *name) {
   actor_t *actor = (actor_t*) malloc( sizeof(actor_t) );
   actor->receive = receive;
   actor->name = name;
-  actor->mailbox = fifo_create(name, 0);
+  actor->mailbox = mailbox_create(name);
+  actor->control = mailbox_create(name);
+  actor->cleanup = NULL;
   actor->pid = 0;
-  actor->state = ACTOR_DORMANT;
-  actor->livestate = ACTOR_IDLE;
+  atomic_init( &actor->state, ACTOR_DORMANT );
+  atomic_init( &actor->livestate, ACTOR_IDLE );
+  atomic_init( &actor->scheduled, 0 );
+  actor->throughput = 0;
+  actor->throughput_usec = 0;
+  actor->worker = -1;
+  atomic_init( &actor->migrations, 0 );
+  atomic_init( &actor->enqueued, 0 );
+  atomic_init( &actor->received, 0 );
+  atomic_init( &actor->depth_max, 0 );
+  atomic_init( &actor->receive_usec, 0 );
+  int i = 0;
+  for ( i = 0; i < ACTOR_SOJOURN_BUCKETS; i++ ) {
+    atomic_init( &actor->sojourn[i], 0 );
+  }
   actor->actor_system = NULL;
+  actor->pid_next = actor->name_next = NULL;
+  actor->pid_pprev = actor->name_pprev = NULL;
+  actor->retired_next = NULL;
+  actor->retired_pprev = NULL;
   dna_log(DEBUG, "Created actor %s", actor->name);
   return actor;
 }
 
+/* Once it's pushed, the message belongs to the receiver: count it, stamp it
+   for the sojourn histogram and trace it before that. */
+void actor_enqueue_internal( actor_t *actor, message_t *message ) {
+  atomic_fetch_add_explicit( &actor->enqueued, 1, memory_order_relaxed );
+  message->queued_usec = actor->actor_system->stats_timing ? dna_time_usec() : 0;
+  dna_trace( TRACE_ENQUEUE, (unsigned long) message, actor->pid, message->id );
+}
+
+/* The receiving side of actor_enqueue_internal(); 'now' is 0 when untimed */
+void actor_dequeue_internal( actor_t *actor, message_t *message, long now ) {
+  long received = atomic_load_explicit( &actor->received, memory_order_relaxed );
+  long depth = atomic_load_explicit( &actor->enqueued, memory_order_relaxed ) - received;
+  if ( depth > atomic_load_explicit( &actor->depth_max, memory_order_relaxed ) ) {
+    atomic_store_explicit( &actor->depth_max, depth, memory_order_relaxed );
+  }
+  atomic_store_explicit( &actor->received, received + 1, memory_order_relaxed );
+  if ( now && message->queued_usec ) {
+    long waited = now - message->queued_usec;
+    int bucket = 0;
+    while ( waited > 0 && bucket < ACTOR_SOJOURN_BUCKETS - 1 ) {
+      waited >>= 1;
+      bucket++;
+    }
+    dna_count( &actor->sojourn[bucket], 1 );
+  }
+  dna_trace( TRACE_DEQUEUE, 0, actor->pid, message->id );
+}
+
+/* The two lanes: the control lane is always emptied first. Only the holder of
+   'scheduled' (or actor_destroy()) may pop. */
+void actor_mailbox_push_internal( actor_t *actor, message_t *message ) {
+  actor_enqueue_internal( actor, message );
+  mailbox_push( (message->flags & MESSAGE_PRIORITY) ? actor->control : actor->mailbox, &message->node );
+}
+
+mailbox_node_t *actor_mailbox_pop_internal( actor_t *actor ) {
+  mailbox_node_t *node = mailbox_pop( actor->control );
+  return node ? node : mailbox_pop( actor->mailbox );
+}
+
+int actor_mailbox_is_empty_internal( actor_t *actor ) {
+  return mailbox_is_empty( actor->control ) && mailbox_is_empty( actor->mailbox );
+}
+
+/* Messages can still be sitting here if they were sent after the actor was
+   killed, or if its last receive task was dropped when the pool shut down. */
 void actor_destroy(actor_t *actor) {
   dna_log(DEBUG, "destroying actor %s", actor->name);
-  fifo_destroy( actor->mailbox );
+  if ( actor->actor_system ) {
+    actor_system_forget_internal( actor->actor_system, actor );
+  }
+  mailbox_node_t *node = NULL;
+  while ( (node = actor_mailbox_pop_internal( actor )) ) {
+    message_t *msg = (message_t*) node;
+    if ( actor->cleanup ) {
+      actor->cleanup( msg );
+    }
+    message_destroy( msg );
+  }
+  mailbox_destroy( actor->mailbox );
+  mailbox_destroy( actor->control );
   free( actor );
 }
 
+/* Each counter is read as it stands: the snapshot isn't taken atomically */
+void actor_stats( actor_t *actor, actor_stats_t *stats ) {
+  stats->pid = actor->pid;
+  stats->name = actor->name;
+  stats->received = atomic_load_explicit( &actor->received, memory_order_relaxed );
+  long depth = atomic_load_explicit( &actor->enqueued, memory_order_relaxed ) - stats->received;
+  stats->depth = depth > 0 ? depth : 0;
+  stats->depth_max = atomic_load_explicit( &actor->depth_max, memory_order_relaxed );
+  stats->receive_usec = atomic_load_explicit( &actor->receive_usec, memory_order_relaxed );
+  stats->migrations = atomic_load_explicit( &actor->migrations, memory_order_relaxed );
+  int i = 0;
+  for ( i = 0; i < ACTOR_SOJOURN_BUCKETS; i++ ) {
+    stats->sojourn[i] = atomic_load_explicit( &actor->sojourn[i], memory_order_relaxed );
+  }
+}
+
+void actor_set_throughput( actor_t *actor, int messages, long usec ) {
+  actor->throughput = messages > 0 ? messages : 0;
+  actor->throughput_usec = usec > 0 ? usec : 0;
+}
+
+void *actor_receive_task_internal(void *arg);
+
+/* Win the 'scheduled' flag. Whoever gets a 1 here owns enqueueing the actor's
+   receive task, alone or in a batch (see actor_broadcast()). */
+int actor_claim_schedule_internal( actor_t *actor ) {
+  return actor->state == ACTOR_ALIVE && !atomic_exchange( &actor->scheduled, 1 );
+}
+
+/*
+ * Queue a receive task for this actor, unless one is already queued or running.
+ * Whoever flips 'scheduled' from 0 to 1 owns the enqueue, so an actor is never
+ * in the thread_pool more than once. The task is aimed at the worker that ran
+ * the actor last, whose cache is likely still warm with its state and mailbox.
+ */
+void actor_schedule_internal( actor_t *actor ) {
+  if ( actor_claim_schedule_internal( actor ) ) {
+    thread_pool_enqueue_to(
+        actor->actor_system->thread_pool,
+        actor->worker,
+        &actor_receive_task_internal,
+        actor
+    );
+  }
+}
+
+/* Hand one message to receive, and settle the sender's promise with the result.
+   Returns 0 if the actor was killed while handling it. */
+int actor_receive_message_internal( actor_t *actor, message_t *msg ) {
+  long now = actor->actor_system->stats_timing ? dna_time_usec() : 0;
+  actor_dequeue_internal( actor, msg, now );
+  long start = dna_trace_clock();
+  promise_t *result = actor->receive( actor, msg );
+  dna_trace_span( TRACE_RECEIVE, start, (unsigned long) msg, actor->pid, msg->id );
+  if ( now ) {
+    dna_count( &actor->receive_usec, dna_time_usec() - now );
+  }
+
+  if ( !msg->promise ) {
+    /* told, or forwarded on: nobody is waiting for this one */
+    promise_destroy( result );
+  } else if ( !result ) {
+    /* when receive returns NULL, a choice has been made by the user to
+     * not use promises. They return NULL because it's more meaningful
+     * than a forcing them to return a value, and placing that in a promise.
+     * We still resolve this as a value to the caller, as NULL will simply
+     * represent completion of the task behind the message this actor received. */
+    promise_set( msg->promise, NULL );
+  } else if ( promise_state( result ) == PROMISE_RESOLVED ) {
+    /* If we got a resolved promise we resolve the promise and unblock the caller,
+       and we're done with the one receive gave us. */
+    promise_set( msg->promise, result->resolution );
+    promise_destroy( result );
+  } else {
+    /* If a promise is still pending, it can only be chained: 'result' will
+       forward its value straight to whoever is waiting on msg->promise.
+       The chain takes over our reference to 'result'. */
+    promise_chain( msg->promise, result );
+  }
+  /* the pool drops the message's reference to the promise */
+  actor_system_message_put( actor->actor_system, msg );
+  return actor->state != ACTOR_DEAD;
+}
+
+/* Move everything left in a dead actor's mailbox to the message pool.
+   The caller must own the actor's 'scheduled' flag, which makes it the
+   mailbox's only consumer. */
+void actor_drain_internal( actor_t *actor ) {
+  mailbox_node_t *node = NULL;
+  while ( (node = actor_mailbox_pop_internal( actor )) ) {
+    message_t *msg = (message_t*) node;
+    if ( actor->cleanup ) {
+      actor->cleanup( msg );
+    }
+    actor_system_message_put( actor->actor_system, msg );
+  }
+}
+
 /**
  * Represents a single scheduled receive task for this actor, queued in a thread_pool.
  * Scheduling, at this point, just means queued to run.
  *
  * Notes:
- *  - We pop a single message from the actor's mailbox, and call receive,
- *    capturing the promise resulting from it.
+ *  - We pop up to the actor's throughput quantum of messages from its mailbox,
+ *    and call receive for each, capturing the promise resulting from it.
  *  - If the promise derived from the receive call does not contain a realized value,
  *    it's another promise. We make sure that the promise derived will be added to the
  *    existing chain. (Stinky people on the bus make my day.)
  *  - An actor can be 'killed' with actor_kill(), so we need to watch for that state,
  *    and stop the actor from processing more messages. Killing an actor also stops it
  *    from being scheduled in the thread_pool.
+ *  - Scheduling is event driven: actor_send() only enqueues this task when it
+ *    wins the actor's 'scheduled' flag, and this task never re-enqueues itself
+ *    unless the mailbox still has work in it. Idle actors cost nothing.
+ *  - Scheduling is sticky: we note which worker runs us, and the next scheduling
+ *    is aimed back at it. Running anywhere else counts as a migration.
  *  - Trouble: 
  *    When code sends an actor a message, a promise is created to represent the eventual
  *    value that will be generated. This value might be one of three things:
  *      a. NULL : simply represent the completion of the work triggered by the message.
  *      b. 'resolved' promise : a promise with .state == PROMISE_RESOLVED
- *      c. 'chained' promise : a promise with .state == PROMISE_CHAINED
- *        - This last option is special: It is a series of 'chained' promises (currently 
- *          implemented as nested fifos) and always ends in a 'resolved' promise. The 
- *          purpose of this type of promise is to allow sequential chaining;
- *          i.e. much work to be completed that will eventually return a promise. 
+ *      c. 'pending' promise : typically the result of an actor_send() to someone else
+ *        - This last option is special: the work continues elsewhere and will
+ *          eventually resolve that promise. The purpose of this type of promise is
+ *          to allow sequential chaining; i.e. much work to be completed that will
+ *          eventually return a value.
  *
- *          Perhaps this is better implemented as a single promise that the user is 
- *          forced to pass along with their messages. As a chain of nested fifos, this grows
- *          to a pretty heavy structure in our memory space.
+ *          We chain it to msg->promise, which makes it forward its value directly
+ *          to the promise at the head of the chain (whoever is blocked in
+ *          promise_get()). Chains never grow: each link only lives as long as the
+ *          message carrying it, and resolving the tail is a single hop.
  *
  * Implementation notes:
  *  - A memory optimization: we recycle the messages used and place them in a pool.
+ *  - Messages sent with actor_tell() carry no promise, so there is nothing to
+ *    resolve: whatever receive returns is simply dropped.
+ *  - One scheduling drains up to 'throughput' messages, or stops once
+ *    'throughput_usec' have passed, whichever comes first, then yields the worker.
  *
  */
 void *actor_receive_task_internal(void *arg) {
   actor_t *actor = (actor_t*) arg;
-  /* will block the thread, so we should only 
-   * execute when there's a message waiting */
-  if (!fifo_is_empty(actor->mailbox) && actor->state != ACTOR_DEAD) {
-
-    actor->livestate = ACTOR_AWAKE;
-    message_t *msg = (message_t*) fifo_pop( actor->mailbox );
-    promise_t *result = actor->receive( actor, msg );
-    if (actor->state == ACTOR_DEAD) {
-      actor_system_message_put( actor->actor_system, msg );
-      // possibly want to destroy the promise here - the actor is now dead
-      return result;
+  actor_system_t *actor_system = actor->actor_system;
+  int budget = actor->throughput > 0 ? actor->throughput : actor_system->throughput;
+  long usec = actor->throughput_usec > 0 ? actor->throughput_usec : actor_system->throughput_usec;
+  long deadline = usec > 0 ? dna_time_usec() + usec : 0;
+
+  /* we hold 'scheduled', so nobody else reads or writes 'worker' meanwhile */
+  int worker = thread_pool_worker_index( actor_system->thread_pool );
+  if ( worker != actor->worker ) {
+    if ( actor->worker >= 0 ) {
+      atomic_fetch_add_explicit( &actor->migrations, 1, memory_order_relaxed );
     }
+    actor->worker = worker;
+  }
 
-    if ( !result ) {
-      /* when receive returns NULL, a choice has been made by the user to
-       * not use promises. They return NULL because it's more meaningful
-       * than a forcing them to return a value, and placing that in a promise.
-       * We still resolve this as a value to the caller, as NULL will simply
-       * represent completion of the task behind the message this actor received. */
-      promise_set( msg->promise, NULL );
-    } else {
-      if (result->state == PROMISE_RESOLVED) {
-        /* If we got a resolved promise we resolve the promise and unblock the caller. */
-        promise_set( msg->promise, result->resolution );
-      } else if (result->state == PROMISE_WAITING) {
-        /* If a promise is still pending, it can only be chained.
-           If we got a chained promise, we should chain internally for
-           resolution to succeed on the entire chain. */
-        promise_chain( msg->promise, result );
-      }
+  actor->livestate = ACTOR_AWAKE;
+  mailbox_node_t *node = NULL;
+  while ( budget-- > 0 && actor->state != ACTOR_DEAD && (node = actor_mailbox_pop_internal( actor )) ) {
+    if ( !actor_receive_message_internal( actor, (message_t*) node ) ) {
+      break;
+    }
+    if ( deadline && dna_time_usec() >= deadline ) {
+      break;
     }
-    actor_system_message_put( actor->actor_system, msg );
-    actor->livestate = ACTOR_IDLE;
   }
-  /* If this actor isn't kaput, schedule another receive */
-  if (actor->state == ACTOR_ALIVE) {
-    thread_pool_enqueue(
-        actor->actor_system->thread_pool, 
-        &actor_receive_task_internal, 
-        actor
-    );
+  actor->livestate = ACTOR_IDLE;
+
+  if ( actor->state == ACTOR_DEAD ) {
+    /* We still own 'scheduled', and keep it, so nothing will queue this actor
+       again; clean out whatever actor_kill() couldn't get at while we ran. */
+    actor_drain_internal( actor );
+    return NULL;
+  }
+
+  /* Give up our claim on the thread_pool, then look again: a send that landed
+     while we were running saw 'scheduled' set and left the enqueue to us. */
+  atomic_store( &actor->scheduled, 0 );
+  if ( !actor_mailbox_is_empty_internal( actor ) ) {
+    actor_schedule_internal( actor );
   }
   return NULL;
 }
 
 /*
  * Actors are scheduled via a thread_queue, this kicks off scheduling.
+ * Messages sent before the actor was spawned are picked up by this first run.
  */
 void actor_spawn( actor_t *actor ) {
   dna_log(DEBUG, "Spawning actor %s.", actor->name);
-  if (actor->state == ACTOR_DORMANT) {
-    actor->state = ACTOR_ALIVE;
-
-    thread_pool_enqueue(
-        actor->actor_system->thread_pool,
-        &actor_receive_task_internal,
-        actor
-    );
+  actor_state_t dormant = ACTOR_DORMANT;
+  if ( atomic_compare_exchange_strong( &actor->state, &dormant, ACTOR_ALIVE ) ) {
+    actor_schedule_internal( actor );
   }
 }
 
@@ -158,17 +346,21 @@ void actor_spawn( actor_t *actor ) {
 void actor_kill( actor_t *actor, void(*cleanup)(void*) ) {
   dna_log(DEBUG, "Killing actor %s.", actor->name);
   actor_system_t *actor_system = actor->actor_system;
-  if (actor->state != ACTOR_DEAD) {
-    actor->state = ACTOR_DEAD;
+  /* the cleanup hook has to be in place before anyone can see ACTOR_DEAD */
+  if ( atomic_load( &actor->state ) != ACTOR_DEAD ) {
+    actor->cleanup = cleanup;
+  }
+  if ( atomic_exchange( &actor->state, ACTOR_DEAD ) != ACTOR_DEAD ) {
     actor_system_remove( actor->actor_system, actor );
-    if ( cleanup ) {
-      fifo_each(actor->mailbox, cleanup);
+    /* Drain any remaining messages to the pool, if we can become the mailbox's
+       consumer. Otherwise a receive task is queued or running, and it will
+       drain the mailbox itself once it sees ACTOR_DEAD. */
+    if ( !atomic_exchange( &actor->scheduled, 1 ) ) {
+      actor_drain_internal( actor );
     }
-    /* Drain any remaining messages to the pool... */
-    actor_system_recycle_messages( actor->actor_system, actor->mailbox );
   }
   /* If the last actor has been killed, stop the actor system */
-  if ( fifo_is_empty( actor_system->actors ) ) {
+  if ( actor_registry_count( actor_system->actors ) == 0 ) {
     dna_log(DEBUG, "Actor system no longer has any actors within it, stopping...");
     actor_system_stop( actor_system );
   }
@@ -176,15 +368,137 @@ void actor_kill( actor_t *actor, void(*cleanup)(void*) ) {
 
 /** (Move to header)
  * actor_send( actor, message ) ->
+ *
+ * The caller owns the returned promise: promise_get() it, or promise_destroy()
+ * it if the result isn't wanted.
  * 
- * Places the message in the actor's mailbox. The next time that the actor is
- * scheduled to run, it will pull one message from it's mailbox, and process it
- * in the user-defined 'receive' function.
+ * Places the message in the actor's mailbox, and schedules the actor if it
+ * isn't already queued. When the actor runs, it will pull messages from it's
+ * mailbox, and process each in the user-defined 'receive' function.
  */
 promise_t *actor_send( actor_t *actor, message_t *message ) {
-  message->promise = promise_create();
-  message->promise->id = message->id;
-  fifo_push( actor->mailbox, message );
-  return message->promise;
+  promise_t *promise = promise_create();
+  promise->id = message->id;
+  /* one reference for the caller, one for the message until it's recycled */
+  message->promise = promise_retain( promise );
+  actor_mailbox_push_internal( actor, message );
+  actor_schedule_internal( actor );
+  return promise;
+}
+
+
+typedef struct {
+  actor_t *actor;
+  message_t *message;
+} actor_pipe_t;
+
+void actor_pipe_then_internal( void *resolution, void *arg ) {
+  actor_pipe_t *pipe = (actor_pipe_t*) arg;
+  message_release_data( pipe->message );
+  pipe->message->data = resolution;
+  actor_tell( pipe->actor, pipe->message );
+  free( pipe );
+}
+
+/**
+ * actor_tell( actor, message ) ->
+ *
+ * Fire and forget: like actor_send(), but no promise is created, and the
+ * actor's receive loop won't resolve anything for this message.
+ */
+void actor_tell( actor_t *actor, message_t *message ) {
+  message->promise = NULL;
+  actor_mailbox_push_internal( actor, message );
+  actor_schedule_internal( actor );
 }
 
+/**
+ * actor_send_batch( actor, messages, count ) ->
+ *
+ * actor_tell() for 'count' messages at once: they are linked up front and
+ * spliced into the mailbox with one exchange, and the actor is scheduled once.
+ * A batch always travels in the ordinary lane, whatever its priority flags.
+ */
+void actor_send_batch( actor_t *actor, message_t **messages, long count ) {
+  if ( count <= 0 ) {
+    return;
+  }
+  long i = 0;
+  for ( i = 0; i < count; i++ ) {
+    messages[i]->promise = NULL;
+    actor_enqueue_internal( actor, messages[i] );
+    if ( i > 0 ) {
+      atomic_store_explicit( &messages[i - 1]->node.next, &messages[i]->node, memory_order_relaxed );
+    }
+  }
+  mailbox_push_chain( actor->mailbox, &messages[0]->node, &messages[count - 1]->node );
+  actor_schedule_internal( actor );
+}
+
+/**
+ * actor_broadcast( group, type, payload, size ) ->
+ *
+ * Tells every member of the group a message of 'type'. The payload is copied
+ * once, into a message_shared_t that every message references and the last
+ * receiver frees. Members that need scheduling are handed to the thread pool
+ * in batches (thread_pool_enqueue_n), rather than one enqueue each.
+ */
+void actor_broadcast( actor_group_t *group, int type, const void *payload, size_t size ) {
+  actor_system_t *actor_system = group->actor_system;
+  message_shared_t *shared = message_shared_create( payload, size );
+  void *ready[THREAD_POOL_BATCH];
+  long count = 0;
+  long i = 0;
+  dna_mutex_lock( group->mutex );
+  for ( i = 0; i < group->count; i++ ) {
+    actor_t *actor = group->members[i];
+    message_t *message = actor_system_message_get( actor_system, NULL, type, NULL );
+    message_set_shared( message, message_shared_retain( shared ) );
+    message->promise = NULL;
+    actor_enqueue_internal( actor, message );
+    mailbox_push( actor->mailbox, &message->node );
+    if ( actor_claim_schedule_internal( actor ) ) {
+      ready[count++] = actor;
+      if ( count == THREAD_POOL_BATCH ) {
+        thread_pool_enqueue_n( actor_system->thread_pool, &actor_receive_task_internal, ready, count );
+        count = 0;
+      }
+    }
+  }
+  dna_mutex_unlock( group->mutex );
+  thread_pool_enqueue_n( actor_system->thread_pool, &actor_receive_task_internal, ready, count );
+  message_shared_release( shared );
+}
+
+/**
+ * actor_forward( actor, message ) ->
+ *
+ * From inside receive: hand the message being received on to another actor,
+ * along with the sender's promise, so that actor's reply resolves it. The
+ * message itself still belongs to the current receive loop, so a copy goes out.
+ */
+void actor_forward( actor_t *actor, message_t *message ) {
+  message_t *forward = actor_system_message_get( actor->actor_system, message->data, message->type, message->from );
+  forward->id = message->id;
+  message_move_data( forward, message );
+  forward->promise = message->promise;
+  message->promise = NULL;
+  forward->flags |= message->flags & MESSAGE_PRIORITY;
+  actor_mailbox_push_internal( actor, forward );
+  actor_schedule_internal( actor );
+}
+
+/**
+ * actor_pipe( promise, actor, message ) ->
+ *
+ * Forwards a promise's value to an actor instead of blocking on it: once the
+ * promise resolves, its value becomes message->data and the message is sent
+ * to 'actor'. Any payload the message already carried is released first.
+ * Takes over the caller's reference to the promise.
+ */
+void actor_pipe( promise_t *promise, actor_t *actor, message_t *message ) {
+  actor_pipe_t *pipe = (actor_pipe_t*) malloc( sizeof(actor_pipe_t) );
+  pipe->actor = actor;
+  pipe->message = message;
+  promise_then( promise, &actor_pipe_then_internal, pipe );
+}
@@ -0,0 +1,60 @@
+#include <stdlib.h>
+
+#include "actor_group.h"
+#include "actor_system.h"
+#include "logger.h"
+
+#define ACTOR_GROUP_INITIAL_CAPACITY 16
+
+/* Groups are registered with the actor system, which destroys them. */
+actor_group_t *actor_group_create( actor_system_t *actor_system, const char *name ) {
+  actor_group_t *group = (actor_group_t*) malloc( sizeof(actor_group_t) );
+  group->name = name;
+  group->actor_system = actor_system;
+  group->members = NULL;
+  group->count = 0;
+  group->capacity = 0;
+  group->mutex = (pthread_mutex_t*) malloc( sizeof(pthread_mutex_t) );
+  dna_mutex_init( group->mutex );
+  fifo_push( actor_system->groups, group );
+  return group;
+}
+
+void actor_group_add( actor_group_t *group, actor_t *actor ) {
+  dna_mutex_lock( group->mutex );
+  if ( group->count == group->capacity ) {
+    group->capacity = group->capacity ? group->capacity * 2 : ACTOR_GROUP_INITIAL_CAPACITY;
+    group->members = (actor_t**) realloc( group->members, group->capacity * sizeof(actor_t*) );
+  }
+  group->members[group->count++] = actor;
+  dna_mutex_unlock( group->mutex );
+}
+
+/* Order isn't kept: the last member takes the leaver's slot. */
+void actor_group_remove( actor_group_t *group, actor_t *actor ) {
+  dna_mutex_lock( group->mutex );
+  long i = 0;
+  for ( i = 0; i < group->count; i++ ) {
+    if ( group->members[i] == actor ) {
+      group->members[i] = group->members[--group->count];
+      break;
+    }
+  }
+  dna_mutex_unlock( group->mutex );
+}
+
+long actor_group_count( actor_group_t *group ) {
+  dna_mutex_lock( group->mutex );
+  long count = group->count;
+  dna_mutex_unlock( group->mutex );
+  return count;
+}
+
+/* Only called by actor_system_destroy(); the members aren't ours to destroy. */
+void actor_group_destroy( actor_group_t *group ) {
+  dna_log(DEBUG, "Destroying actor group %s...", group->name);
+  free( group->members );
+  dna_mutex_destroy( group->mutex );
+  free( group->mutex );
+  free( group );
+}
@@ -0,0 +1,189 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "actor_registry.h"
+#include "actor.h"
+#include "logger.h"
+
+unsigned long actor_registry_hash_pid( unsigned long pid ) {
+  return pid * 0x9E3779B97F4A7C15UL;
+}
+
+/* FNV-1a */
+unsigned long actor_registry_hash_name( const char *name ) {
+  unsigned long hash = 0xcbf29ce484222325UL;
+  while ( name && *name ) {
+    hash ^= (unsigned char) *name++;
+    hash *= 0x100000001b3UL;
+  }
+  return hash;
+}
+
+actor_registry_t *actor_registry_create() {
+  actor_registry_t *registry = (actor_registry_t*) malloc( sizeof(actor_registry_t) );
+  registry->buckets = ACTOR_REGISTRY_INITIAL_BUCKETS;
+  registry->by_pid = (actor_t**) calloc( registry->buckets, sizeof(actor_t*) );
+  registry->by_name = (actor_t**) calloc( registry->buckets, sizeof(actor_t*) );
+  registry->count = 0;
+  registry->mutex = (pthread_mutex_t*) malloc( sizeof(pthread_mutex_t) );
+  dna_mutex_init( registry->mutex );
+  return registry;
+}
+
+void actor_registry_link_internal( actor_registry_t *registry, actor_t *actor ) {
+  long mask = registry->buckets - 1;
+  actor_t **head = &registry->by_pid[actor_registry_hash_pid( actor->pid ) & mask];
+  actor->pid_next = *head;
+  actor->pid_pprev = head;
+  if ( *head ) {
+    (*head)->pid_pprev = &actor->pid_next;
+  }
+  *head = actor;
+
+  head = &registry->by_name[actor_registry_hash_name( actor->name ) & mask];
+  actor->name_next = *head;
+  actor->name_pprev = head;
+  if ( *head ) {
+    (*head)->name_pprev = &actor->name_next;
+  }
+  *head = actor;
+}
+
+/* Double the buckets, and rehash every actor into them. Old bucket i splits
+   into new buckets i and i + buckets; appending to those, rather than pushing
+   onto them, keeps each chain newest first, so a name lookup still finds the
+   newest of its namesakes. */
+void actor_registry_grow_internal( actor_registry_t *registry ) {
+  actor_t **by_pid = registry->by_pid;
+  actor_t **by_name = registry->by_name;
+  long buckets = registry->buckets;
+  long mask = buckets * 2 - 1;
+  registry->buckets *= 2;
+  registry->by_pid = (actor_t**) calloc( registry->buckets, sizeof(actor_t*) );
+  registry->by_name = (actor_t**) calloc( registry->buckets, sizeof(actor_t*) );
+  long i = 0;
+  for ( i = 0; i < buckets; i++ ) {
+    actor_t **tails[2] = { &registry->by_pid[i], &registry->by_pid[i + buckets] };
+    actor_t *actor = by_pid[i];
+    while ( actor ) {
+      actor_t *next = actor->pid_next;
+      actor_t ***tail = &tails[(long) (actor_registry_hash_pid( actor->pid ) & mask) != i];
+      actor->pid_next = NULL;
+      actor->pid_pprev = *tail;
+      **tail = actor;
+      *tail = &actor->pid_next;
+      actor = next;
+    }
+
+    tails[0] = &registry->by_name[i];
+    tails[1] = &registry->by_name[i + buckets];
+    actor = by_name[i];
+    while ( actor ) {
+      actor_t *next = actor->name_next;
+      actor_t ***tail = &tails[(long) (actor_registry_hash_name( actor->name ) & mask) != i];
+      actor->name_next = NULL;
+      actor->name_pprev = *tail;
+      **tail = actor;
+      *tail = &actor->name_next;
+      actor = next;
+    }
+  }
+  free( by_pid );
+  free( by_name );
+}
+
+void actor_registry_insert( actor_registry_t *registry, actor_t *actor ) {
+  dna_mutex_lock( registry->mutex );
+  if ( registry->count >= registry->buckets ) {
+    actor_registry_grow_internal( registry );
+  }
+  actor_registry_link_internal( registry, actor );
+  registry->count++;
+  dna_mutex_unlock( registry->mutex );
+}
+
+int actor_registry_remove( actor_registry_t *registry, actor_t *actor ) {
+  int removed = 0;
+  dna_mutex_lock( registry->mutex );
+  if ( actor->pid_pprev ) {
+    *actor->pid_pprev = actor->pid_next;
+    if ( actor->pid_next ) {
+      actor->pid_next->pid_pprev = actor->pid_pprev;
+    }
+    *actor->name_pprev = actor->name_next;
+    if ( actor->name_next ) {
+      actor->name_next->name_pprev = actor->name_pprev;
+    }
+    actor->pid_next = actor->name_next = NULL;
+    actor->pid_pprev = actor->name_pprev = NULL;
+    registry->count--;
+    removed = 1;
+  }
+  dna_mutex_unlock( registry->mutex );
+  return removed;
+}
+
+actor_t *actor_registry_find( actor_registry_t *registry, unsigned long pid ) {
+  dna_mutex_lock( registry->mutex );
+  actor_t *actor = registry->by_pid[actor_registry_hash_pid( pid ) & (registry->buckets - 1)];
+  while ( actor && actor->pid != pid ) {
+    actor = actor->pid_next;
+  }
+  dna_mutex_unlock( registry->mutex );
+  return actor;
+}
+
+actor_t *actor_registry_find_name( actor_registry_t *registry, const char *name ) {
+  dna_mutex_lock( registry->mutex );
+  actor_t *actor = registry->by_name[actor_registry_hash_name( name ) & (registry->buckets - 1)];
+  while ( actor && strcmp( actor->name, name ) ) {
+    actor = actor->name_next;
+  }
+  dna_mutex_unlock( registry->mutex );
+  return actor;
+}
+
+long actor_registry_count( actor_registry_t *registry ) {
+  dna_mutex_lock( registry->mutex );
+  long count = registry->count;
+  dna_mutex_unlock( registry->mutex );
+  return count;
+}
+
+void actor_registry_each( actor_registry_t *registry, void(*func)(actor_t*) ) {
+  dna_mutex_lock( registry->mutex );
+  long i = 0;
+  for ( i = 0; i < registry->buckets; i++ ) {
+    actor_t *actor = registry->by_pid[i];
+    while ( actor ) {
+      actor_t *next = actor->pid_next;
+      func( actor );
+      actor = next;
+    }
+  }
+  dna_mutex_unlock( registry->mutex );
+}
+
+void actor_registry_each_arg( actor_registry_t *registry, void(*func)(actor_t*, void*), void *arg ) {
+  dna_mutex_lock( registry->mutex );
+  long i = 0;
+  for ( i = 0; i < registry->buckets; i++ ) {
+    actor_t *actor = registry->by_pid[i];
+    while ( actor ) {
+      actor_t *next = actor->pid_next;
+      func( actor, arg );
+      actor = next;
+    }
+  }
+  dna_mutex_unlock( registry->mutex );
+}
+
+/* The actors aren't ours: destroy them first, or keep them. */
+void actor_registry_destroy( actor_registry_t *registry ) {
+  dna_log(DEBUG, "Destroying actor registry (%li actors)...", registry->count);
+  free( registry->by_pid );
+  free( registry->by_name );
+  dna_mutex_destroy( registry->mutex );
+  free( registry->mutex );
+  free( registry );
+}
@@ -1,93 +1,403 @@
 #include <stdlib.h>
+#include <sys/mman.h>
 
 #include "message.h"
 #include "promise.h"
 #include "actor_system.h"
+#include "actor_group.h"
+#include "threads.h"
+#include "logger.h"
 #include "stdio.h"
 
 #define ACTOR_SYSTEM_LOG
 
+/* arena messages, inline payload included, are cache-line aligned and never share a line */
+#define MESSAGE_ARENA_STRIDE(payload) ((sizeof(message_t) + (payload) + 63) & ~(size_t) 63)
+#define HUGE_PAGE_SIZE (2UL * 1024 * 1024)
+
+void actor_system_config_init( actor_system_config_t *config ) {
+  config->thread_count = ACTOR_SYSTEM_DEFAULT_THREADS;
+  config->pin_workers = 0;
+  config->scheduler = THREAD_POOL_SHARED;
+  config->throughput = ACTOR_SYSTEM_DEFAULT_THROUGHPUT;
+  config->throughput_usec = ACTOR_SYSTEM_DEFAULT_THROUGHPUT_USEC;
+  config->message_capacity = ACTOR_SYSTEM_DEFAULT_MESSAGE_CAPACITY;
+  config->huge_pages = 0;
+  config->message_inline = ACTOR_SYSTEM_DEFAULT_MESSAGE_INLINE;
+  config->stats_timing = 1;
+}
+
+/*
+ * Map one block for 'capacity' messages and seed the shared message pool with
+ * them, in address order, so that workers hand out neighbouring messages.
+ * With huge_pages we ask for MAP_HUGETLB first, and fall back to transparent
+ * huge pages (a hint the kernel is free to ignore) if none are reserved.
+ * Once the arena is used up, message_create() takes over as before.
+ */
+void actor_system_arena_create_internal( actor_system_t *actor_system, long capacity, int huge_pages ) {
+  actor_system->message_arena = NULL;
+  actor_system->message_arena_size = 0;
+  actor_system->message_capacity = 0;
+  if ( capacity <= 0 ) {
+    return;
+  }
+  size_t stride = MESSAGE_ARENA_STRIDE( actor_system->message_inline );
+  size_t size = capacity * stride;
+  void *arena = MAP_FAILED;
+  if ( huge_pages ) {
+    size_t huge_size = (size + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+    arena = mmap( NULL, huge_size, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0 );
+    if ( arena != MAP_FAILED ) {
+      size = huge_size;
+    } else {
+      dna_log(DEBUG, "No hugetlb pages for the message arena, falling back to THP.");
+    }
+  }
+  if ( arena == MAP_FAILED ) {
+    arena = mmap( NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+    if ( arena == MAP_FAILED ) {
+      dna_log(ERROR, "Unable to map a message arena of %lu bytes.", size);
+      return;
+    }
+    if ( huge_pages ) {
+      madvise( arena, size, MADV_HUGEPAGE );
+    }
+  }
+  actor_system->message_arena = arena;
+  actor_system->message_arena_size = size;
+  actor_system->message_capacity = capacity;
+
+  long i = 0;
+  message_t *prev = NULL;
+  for ( i = capacity - 1; i >= 0; i-- ) {
+    message_t *msg = (message_t*) ((char*) arena + i * stride);
+    message_init( msg, NULL, 0, NULL );
+    msg->flags = MESSAGE_FROM_ARENA;
+    msg->payload_capacity = actor_system->message_inline;
+    msg->pool_next = prev;
+    prev = msg;
+  }
+  actor_system->message_pool = prev;
+  actor_system->message_pool_size = capacity;
+}
+
 actor_system_t *actor_system_create(const char* name){
+  actor_system_config_t config;
+  actor_system_config_init( &config );
+  return actor_system_create_with_config( name, &config );
+}
+
+actor_system_t *actor_system_create_with_config( const char *name, const actor_system_config_t *config ) {
   actor_system_t *actor_system = (actor_system_t*) malloc( sizeof(actor_system_t) );
   actor_system->name = name;
-  actor_system->message_pool = fifo_create("message pool", 0 /* TODO:message pool size!? */);
-  actor_system->actors = fifo_create("actors", 0);
-  actor_system->thread_pool = thread_pool_create("actor system thread pool", 8 /* CPU detection here? */);
+  actor_system->message_pool = NULL;
+  actor_system->message_pool_size = 0;
+  actor_system->message_pool_mutex = (pthread_mutex_t*) malloc( sizeof(pthread_mutex_t) );
+  dna_mutex_init( actor_system->message_pool_mutex );
+  actor_system->message_inline = config->message_inline > 0 ? config->message_inline : 0;
+  atomic_init( &actor_system->message_allocs, 0 );
+  actor_system->stats_timing = config->stats_timing;
+  actor_system_arena_create_internal( actor_system, config->message_capacity, config->huge_pages );
+  actor_system->actors = actor_registry_create();
+  atomic_init( &actor_system->next_pid, 0 );
+  actor_system->groups = fifo_create("groups", 0);
+  actor_system->retired = NULL;
+  actor_system->retired_mutex = (pthread_mutex_t*) malloc( sizeof(pthread_mutex_t) );
+  dna_mutex_init( actor_system->retired_mutex );
+  actor_system->thread_pool = thread_pool_create_mode("actor system thread pool",
+      config->thread_count, config->scheduler);
+  if ( config->pin_workers ) {
+    thread_pool_pin_workers( actor_system->thread_pool );
+  }
+  int workers = actor_system->thread_pool->worker_count;
+  actor_system->message_caches = (message_cache_t*) aligned_alloc( 64,
+      workers * sizeof(message_cache_t) );
+  int i = 0;
+  for ( i = 0; i < workers; i++ ) {
+    actor_system->message_caches[i].head = NULL;
+    atomic_init( &actor_system->message_caches[i].count, 0 );
+    atomic_init( &actor_system->message_caches[i].allocated, 0 );
+  }
+  actor_system_set_throughput( actor_system, config->throughput, config->throughput_usec );
   return actor_system;
 }
 
+void actor_system_set_throughput( actor_system_t *actor_system, int messages, long usec ) {
+  actor_system->throughput = messages > 0 ? messages : 1;
+  actor_system->throughput_usec = usec > 0 ? usec : 0;
+}
+
+/* Registers the actor under a new pid */
 void actor_system_add(actor_system_t *actor_system, actor_t *actor) {
   actor->actor_system = actor_system;
-  fifo_push( actor_system->actors, actor );
+  actor->pid = atomic_fetch_add( &actor_system->next_pid, 1 ) + 1;
+  actor_registry_insert( actor_system->actors, actor );
 }
 
+/* The actor stays ours until it's destroyed: see actor_system_destroy() */
 void actor_system_remove( actor_system_t *actor_system, actor_t *actor ) {
-  if ( !fifo_is_empty(actor_system->actors) ) {
-    int i = 0;
-    long len = fifo_count( actor_system->actors );
-    for ( i = 0; i < len; i++ ) {
-      actor_t *test = (actor_t*) fifo_pop( actor_system->actors );
-      if (test == actor) {
-        return;
-      } else {
-        fifo_push( actor_system->actors, test );
-      }
+  if ( actor_registry_remove( actor_system->actors, actor ) ) {
+    dna_mutex_lock( actor_system->retired_mutex );
+    actor->retired_next = actor_system->retired;
+    if ( actor->retired_next ) {
+      actor->retired_next->retired_pprev = &actor->retired_next;
     }
+    actor->retired_pprev = &actor_system->retired;
+    actor_system->retired = actor;
+    dna_mutex_unlock( actor_system->retired_mutex );
   }
 }
 
-void spawn_actor( void *arg ) {
-  actor_t *actor = (actor_t*)arg;
+void actor_system_forget_internal( actor_system_t *actor_system, actor_t *actor ) {
+  dna_mutex_lock( actor_system->retired_mutex );
+  if ( actor->retired_pprev ) {
+    *actor->retired_pprev = actor->retired_next;
+    if ( actor->retired_next ) {
+      actor->retired_next->retired_pprev = actor->retired_pprev;
+    }
+    actor->retired_next = NULL;
+    actor->retired_pprev = NULL;
+  }
+  dna_mutex_unlock( actor_system->retired_mutex );
+}
+
+actor_t *actor_system_lookup( actor_system_t *actor_system, unsigned long pid ) {
+  return actor_registry_find( actor_system->actors, pid );
+}
+
+actor_t *actor_system_lookup_name( actor_system_t *actor_system, const char *name ) {
+  return actor_registry_find_name( actor_system->actors, name );
+}
+
+void spawn_actor( actor_t *actor ) {
   if ( actor && actor->actor_system ) {
     actor_spawn(actor);
   }
 }
 
 void actor_system_run(actor_system_t *actor_system) {
-  fifo_each( actor_system->actors, &spawn_actor );
+  actor_registry_each( actor_system->actors, &spawn_actor );
 }
 
-void destroy_actor( void *arg ) {
-  actor_destroy((actor_t*)arg);
+void destroy_actor( actor_t *actor ) {
+  actor_destroy( actor );
 }
 
-void destroy_message( void *arg ) {
-  message_destroy((message_t*)arg);
+void destroy_message_list( message_t *msg ) {
+  while ( msg ) {
+    message_t *next = msg->pool_next;
+    message_destroy( msg );
+    msg = next;
+  }
 }
 
+/* The workers go first: nothing may touch the message pool while we free it. */
 void actor_system_destroy(actor_system_t *actor_system) {
-  fifo_each( actor_system->actors, &destroy_actor );
-  fifo_empty( actor_system->actors );
-  fifo_destroy( actor_system->actors );
-
-  fifo_each( actor_system->message_pool, &destroy_message );
-  fifo_empty( actor_system->message_pool );
-  fifo_destroy( actor_system->message_pool );
-
+  int workers = actor_system->thread_pool->worker_count;
   thread_pool_exit_all( actor_system->thread_pool );
   thread_pool_destroy( actor_system->thread_pool );
+
+  actor_registry_each( actor_system->actors, &destroy_actor );
+  actor_registry_destroy( actor_system->actors );
+
+  /* Killed actors are the caller's to destroy, after us. A receive task that
+     the pool dropped on exit never drained their mailboxes, and those may
+     hold arena messages: empty them now, while the arena is still mapped,
+     and cut the actors loose so actor_destroy() leaves us alone. */
+  actor_t *actor = actor_system->retired;
+  while ( actor ) {
+    actor_t *next = actor->retired_next;
+    mailbox_node_t *node = NULL;
+    while ( (node = actor_mailbox_pop_internal( actor )) ) {
+      message_t *msg = (message_t*) node;
+      if ( actor->cleanup ) {
+        actor->cleanup( msg );
+      }
+      message_destroy( msg );
+    }
+    actor->retired_next = NULL;
+    actor->retired_pprev = NULL;
+    actor->actor_system = NULL;
+    actor = next;
+  }
+  dna_mutex_destroy( actor_system->retired_mutex );
+  free( actor_system->retired_mutex );
+
+  actor_group_t *group = NULL;
+  while ( (group = (actor_group_t*) fifo_try_pop( actor_system->groups )) ) {
+    actor_group_destroy( group );
+  }
+  fifo_destroy( actor_system->groups );
+
+  int i = 0;
+  for ( i = 0; i < workers; i++ ) {
+    destroy_message_list( actor_system->message_caches[i].head );
+  }
+  free( actor_system->message_caches );
+  destroy_message_list( actor_system->message_pool );
+  if ( actor_system->message_arena ) {
+    munmap( actor_system->message_arena, actor_system->message_arena_size );
+  }
+  dna_mutex_destroy( actor_system->message_pool_mutex );
+  free( actor_system->message_pool_mutex );
   free( actor_system );
 }
 
+/* Take up to 'max' messages off the shared pool, as a linked list. */
+message_t *actor_system_message_take_internal( actor_system_t *actor_system, long max, long *taken ) {
+  dna_mutex_lock( actor_system->message_pool_mutex );
+  message_t *head = actor_system->message_pool;
+  message_t *tail = head;
+  long count = 0;
+  if ( head ) {
+    count = 1;
+    while ( count < max && tail->pool_next ) {
+      tail = tail->pool_next;
+      count++;
+    }
+    actor_system->message_pool = tail->pool_next;
+    actor_system->message_pool_size -= count;
+    tail->pool_next = NULL;
+  }
+  dna_mutex_unlock( actor_system->message_pool_mutex );
+  *taken = count;
+  return head;
+}
+
+/* Splice a linked list of 'count' messages, ending at 'tail', onto the shared pool. */
+void actor_system_message_give_internal( actor_system_t *actor_system, message_t *head, message_t *tail, long count ) {
+  dna_mutex_lock( actor_system->message_pool_mutex );
+  tail->pool_next = actor_system->message_pool;
+  actor_system->message_pool = head;
+  actor_system->message_pool_size += count;
+  dna_mutex_unlock( actor_system->message_pool_mutex );
+}
+
 message_t *actor_system_message_get( actor_system_t *actor_system, void *data, int type, actor_t *from ) {
-  if ( !fifo_is_empty( actor_system->message_pool ) ) {
-    message_t* msg = (message_t*) fifo_pop( actor_system->message_pool );
+  message_t *msg = NULL;
+  long taken = 0;
+  int worker = thread_pool_worker_index( actor_system->thread_pool );
+  if ( worker >= 0 ) {
+    message_cache_t *cache = &actor_system->message_caches[worker];
+    if ( !cache->head ) {
+      cache->head = actor_system_message_take_internal( actor_system, MESSAGE_CACHE_BATCH, &taken );
+      atomic_store_explicit( &cache->count, taken, memory_order_relaxed );
+    }
+    if ( (msg = cache->head) ) {
+      cache->head = msg->pool_next;
+      dna_count( &cache->count, -1 );
+    }
+  } else {
+    msg = actor_system_message_take_internal( actor_system, 1, &taken );
+  }
+
+  if ( msg ) {
     msg->type = type;
     /* purposely keeping the original alloc'd message->id */
     msg->data = data;
     msg->promise = NULL;
     msg->from = from;
+    msg->pool_next = NULL;
     return msg;
   }
-  return message_create(data, type, from);
+  if ( worker >= 0 ) {
+    dna_count( &actor_system->message_caches[worker].allocated, 1 );
+  } else {
+    atomic_fetch_add_explicit( &actor_system->message_allocs, 1, memory_order_relaxed );
+  }
+  return message_create_sized(actor_system->message_inline, data, type, from);
 }
 
 void actor_system_stop( actor_system_t * actor_system ) {
   thread_pool_exit_all( actor_system->thread_pool );
 }
 
+/* Recycling a message frees a payload it owns, and drops its reference to
+   the sender's promise. */
 void actor_system_message_put(actor_system_t *actor_system, message_t *message) {
-  fifo_push(actor_system->message_pool, message);
+  message_release_data( message );
+  message_set_priority( message, 0 );
+  promise_destroy( message->promise );
+  message->promise = NULL;
+  int worker = thread_pool_worker_index( actor_system->thread_pool );
+  if ( worker < 0 ) {
+    actor_system_message_give_internal( actor_system, message, message, 1 );
+    return;
+  }
+  message_cache_t *cache = &actor_system->message_caches[worker];
+  message->pool_next = cache->head;
+  cache->head = message;
+  long count = atomic_load_explicit( &cache->count, memory_order_relaxed ) + 1;
+  if ( count > MESSAGE_CACHE_MAX ) {
+    /* keep the most recently used half, spill the rest in one go */
+    message_t *keep = cache->head;
+    long i = 0;
+    for ( i = 1; i < count - MESSAGE_CACHE_BATCH; i++ ) {
+      keep = keep->pool_next;
+    }
+    message_t *spill = keep->pool_next;
+    message_t *tail = spill;
+    while ( tail->pool_next ) {
+      tail = tail->pool_next;
+    }
+    keep->pool_next = NULL;
+    actor_system_message_give_internal( actor_system, spill, tail, MESSAGE_CACHE_BATCH );
+    count -= MESSAGE_CACHE_BATCH;
+  }
+  atomic_store_explicit( &cache->count, count, memory_order_relaxed );
+}
+
+typedef struct {
+  actor_system_stats_t *stats;
+  long capacity;
+} actor_system_stats_fill_t;
+
+void actor_system_stats_actor_internal( actor_t *actor, void *arg ) {
+  actor_system_stats_fill_t *fill = (actor_system_stats_fill_t*) arg;
+  if ( fill->stats->actor_count < fill->capacity ) {
+    actor_stats( actor, &fill->stats->actors[fill->stats->actor_count++] );
+  }
+}
+
+/*
+ * Snapshot every counter we keep: per actor, per worker and for the system as
+ * a whole. Nothing is paused for it; the counters are cheap to keep because
+ * each has a single writer (or is per thread), and only add up here.
+ * Free it with actor_system_stats_destroy().
+ */
+actor_system_stats_t *actor_system_stats( actor_system_t *actor_system ) {
+  actor_system_stats_t *stats = (actor_system_stats_t*) malloc( sizeof(actor_system_stats_t) );
+  thread_pool_t *pool = actor_system->thread_pool;
+  stats->worker_count = pool->worker_count;
+  stats->workers = (thread_pool_worker_stats_t*) calloc( pool->worker_count, sizeof(thread_pool_worker_stats_t) );
+  stats->message_allocs = atomic_load_explicit( &actor_system->message_allocs, memory_order_relaxed );
+  dna_mutex_lock( actor_system->message_pool_mutex );
+  stats->message_pool = actor_system->message_pool_size;
+  dna_mutex_unlock( actor_system->message_pool_mutex );
+  int i = 0;
+  for ( i = 0; i < pool->worker_count; i++ ) {
+    thread_pool_worker_stats( pool, i, &stats->workers[i] );
+    stats->message_pool += atomic_load_explicit( &actor_system->message_caches[i].count, memory_order_relaxed );
+    stats->message_allocs += atomic_load_explicit( &actor_system->message_caches[i].allocated, memory_order_relaxed );
+  }
+  stats->message_capacity = actor_system->message_capacity;
+  promise_counts( &stats->promises_created, &stats->promises_live );
+
+  /* actors added meanwhile may not make it in */
+  actor_system_stats_fill_t fill = { stats, actor_registry_count( actor_system->actors ) };
+  stats->actor_count = 0;
+  stats->actors = (actor_stats_t*) calloc( fill.capacity > 0 ? fill.capacity : 1, sizeof(actor_stats_t) );
+  actor_registry_each_arg( actor_system->actors, &actor_system_stats_actor_internal, &fill );
+  return stats;
+}
+
+void actor_system_stats_destroy( actor_system_stats_t *stats ) {
+  if ( stats ) {
+    free( stats->workers );
+    free( stats->actors );
+    free( stats );
+  }
 }
 
 void actor_system_recycle_messages(actor_system_t *actor_system, fifo_t *message_fifo) {
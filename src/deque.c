@@ -0,0 +1,105 @@
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <assert.h>
+
+#include "deque.h"
+
+deque_array_t *deque_array_create( long capacity ) {
+  deque_array_t *array = (deque_array_t*) malloc( sizeof(deque_array_t) + capacity * sizeof(void*) );
+  array->capacity = capacity;
+  array->retired = NULL;
+  return array;
+}
+
+deque_t *deque_create( long capacity ) {
+  assert( capacity > 0 && (capacity & (capacity - 1)) == 0 ); // power of two
+  deque_t *deque = (deque_t*) aligned_alloc( 64, sizeof(deque_t) );
+  atomic_init( &deque->top, 0 );
+  atomic_init( &deque->bottom, 0 );
+  atomic_init( &deque->array, deque_array_create( capacity ) );
+  return deque;
+}
+
+/* owner only: double the ring, copying the live range [top, bottom) */
+deque_array_t *deque_grow_internal( deque_t *deque, deque_array_t *old, long top, long bottom ) {
+  deque_array_t *array = deque_array_create( old->capacity * 2 );
+  long i = 0;
+  for ( i = top; i < bottom; i++ ) {
+    void *item = atomic_load_explicit( &old->items[i & (old->capacity - 1)], memory_order_relaxed );
+    atomic_store_explicit( &array->items[i & (array->capacity - 1)], item, memory_order_relaxed );
+  }
+  array->retired = old;
+  atomic_store_explicit( &deque->array, array, memory_order_release );
+  return array;
+}
+
+void deque_push( deque_t *deque, void *item ) {
+  long bottom = atomic_load_explicit( &deque->bottom, memory_order_relaxed );
+  long top = atomic_load_explicit( &deque->top, memory_order_acquire );
+  deque_array_t *array = atomic_load_explicit( &deque->array, memory_order_relaxed );
+  if ( bottom - top > array->capacity - 1 ) {
+    array = deque_grow_internal( deque, array, top, bottom );
+  }
+  atomic_store_explicit( &array->items[bottom & (array->capacity - 1)], item, memory_order_relaxed );
+  atomic_thread_fence( memory_order_release );
+  atomic_store_explicit( &deque->bottom, bottom + 1, memory_order_relaxed );
+}
+
+void *deque_pop( deque_t *deque ) {
+  long bottom = atomic_load_explicit( &deque->bottom, memory_order_relaxed ) - 1;
+  deque_array_t *array = atomic_load_explicit( &deque->array, memory_order_relaxed );
+  atomic_store_explicit( &deque->bottom, bottom, memory_order_relaxed );
+  atomic_thread_fence( memory_order_seq_cst );
+  long top = atomic_load_explicit( &deque->top, memory_order_relaxed );
+  void *item = NULL;
+  if ( top <= bottom ) {
+    item = atomic_load_explicit( &array->items[bottom & (array->capacity - 1)], memory_order_relaxed );
+    if ( top == bottom ) {
+      /* last item: race the thieves for it */
+      if ( !atomic_compare_exchange_strong_explicit( &deque->top, &top, top + 1,
+              memory_order_seq_cst, memory_order_relaxed ) ) {
+        item = NULL;
+      }
+      atomic_store_explicit( &deque->bottom, bottom + 1, memory_order_relaxed );
+    }
+  } else {
+    atomic_store_explicit( &deque->bottom, bottom + 1, memory_order_relaxed );
+  }
+  return item;
+}
+
+/* Returns NULL if the deque looked empty, or if another thief won the race. */
+void *deque_steal( deque_t *deque ) {
+  long top = atomic_load_explicit( &deque->top, memory_order_acquire );
+  atomic_thread_fence( memory_order_seq_cst );
+  long bottom = atomic_load_explicit( &deque->bottom, memory_order_acquire );
+  void *item = NULL;
+  if ( top < bottom ) {
+    deque_array_t *array = atomic_load_explicit( &deque->array, memory_order_acquire );
+    item = atomic_load_explicit( &array->items[top & (array->capacity - 1)], memory_order_relaxed );
+    if ( !atomic_compare_exchange_strong_explicit( &deque->top, &top, top + 1,
+            memory_order_seq_cst, memory_order_relaxed ) ) {
+      return NULL;
+    }
+  }
+  return item;
+}
+
+/* A snapshot; only exact when the owner asks and nobody is stealing. */
+long deque_count( deque_t *deque ) {
+  long bottom = atomic_load( &deque->bottom );
+  long top = atomic_load( &deque->top );
+  return bottom > top ? bottom - top : 0;
+}
+
+void deque_destroy( deque_t *deque ) {
+  if (deque) {
+    deque_array_t *array = atomic_load( &deque->array );
+    while ( array ) {
+      deque_array_t *retired = array->retired;
+      free( array );
+      array = retired;
+    }
+    free( deque );
+  }
+}
@@ -2,6 +2,8 @@
 #include <pthread.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <errno.h>
+#include <time.h>
 
 #include "fifo.h"
 #include "threads.h"
@@ -11,24 +13,65 @@
  TODO:
  | Reusability |
  - separate concurrency primitives from fifo_t into new concurrent_fifo_t
+*/
 
- | Optimizations |
- - implement an optional size limit for fifo_t
-   - add pthread_cond_t to fifo_t -> wait_room
-   - push would then block if there is no room, and pop would signal that
+/* Node slab: every fifo carves its nodes out of chunks it allocates itself,
+   and keeps released nodes on 'node_cache' for the next push. Chunks start
+   small and double, so short-lived fifos stay cheap. Once node_cache_max
+   nodes have been carved, further nodes are plain mallocs, freed on release.
+   All of this happens under the fifo's mutex. */
+#define NODE_CHUNK_MIN 4
+#define NODE_CACHE_MAX 4096
 
- - implement a pre-allocated region of memory to start with for node_t instances
-   - add recycling of node_t, rather than malloc + free each time.
-*/
+struct node_chunk_t {
+  node_chunk_t *next;
+  node_t nodes[];
+};
 
 node_t *node_create( void *data ) {
   node_t *node = (node_t*) malloc( sizeof(node_t) );
   node->next = NULL;
   node->data = data;
+  node->cached = 0;
   return node;
 }
 
+void node_destroy( node_t *node ) {
+  if (node) { free( node ); }
+}
+
+void node_cache_push( fifo_t *fifo, node_t *node ) {
+  if (node) {
+    node->data = NULL;
+    node->next = fifo->node_cache;
+    fifo->node_cache = node;
+  }
+}
+
+/* carve a new chunk onto the cache, if we're still under node_cache_max */
+void node_cache_grow( fifo_t *fifo ) {
+  long count = fifo->node_cache_size > NODE_CHUNK_MIN ? fifo->node_cache_size : NODE_CHUNK_MIN;
+  if ( count > fifo->node_cache_max - fifo->node_cache_size ) {
+    count = fifo->node_cache_max - fifo->node_cache_size;
+  }
+  if ( count <= 0 ) {
+    return;
+  }
+  node_chunk_t *chunk = (node_chunk_t*) malloc( sizeof(node_chunk_t) + count * sizeof(node_t) );
+  chunk->next = fifo->node_chunks;
+  fifo->node_chunks = chunk;
+  fifo->node_cache_size += count;
+  long i = 0;
+  for ( i = 0; i < count; i++ ) {
+    chunk->nodes[i].cached = 1;
+    node_cache_push( fifo, &chunk->nodes[i] );
+  }
+}
+
 node_t *node_cache_pop( fifo_t *fifo ) {
+  if ( !fifo->node_cache ) {
+    node_cache_grow( fifo );
+  }
   if (fifo->node_cache) {
     node_t *item = fifo->node_cache;
     fifo->node_cache = item->next;
@@ -39,21 +82,21 @@ node_t *node_cache_pop( fifo_t *fifo ) {
   return NULL;
 }
 
-void node_cache_push( fifo_t *fifo, node_t *node ) {
-  if (node) {
-    node->data = NULL;
-    node->next = NULL;
-    node_t *head = NULL;
-    while ( (head = fifo->node_cache) ) {
-      if (!head->next) {
-        head->next = node;
-      }
-    }
+node_t *node_alloc( fifo_t *fifo, void *data ) {
+  node_t *node = node_cache_pop( fifo );
+  if ( node ) {
+    node->data = data;
+    return node;
   }
+  return node_create( data );
 }
 
-void node_destroy( node_t *node ) {
-  if (node) { free( node ); }
+void node_release( fifo_t *fifo, node_t *node ) {
+  if ( node && node->cached ) {
+    node_cache_push( fifo, node );
+  } else {
+    node_destroy( node );
+  }
 }
 
 fifo_t *fifo_create( const char *name, long max_size ) {
@@ -61,16 +104,51 @@ fifo_t *fifo_create( const char *name, long max_size ) {
   if (name) fifo->name = name;
   fifo->mutex = (pthread_mutex_t*) malloc( sizeof( pthread_mutex_t ) );
   fifo->wait_pop = (pthread_cond_t*) malloc( sizeof( pthread_cond_t ) );
+  fifo->wait_push = (pthread_cond_t*) malloc( sizeof( pthread_cond_t ) );
   dna_mutex_init( fifo->mutex );
   dna_cond_init( fifo->wait_pop );
+  dna_cond_init( fifo->wait_push );
   fifo->size = 0;
+  fifo->max_size = max_size;
+  fifo->node_cache = NULL;
+  fifo->node_chunks = NULL;
+  fifo->node_cache_size = 0;
+  /* a bounded fifo never holds more than max_size nodes at once */
+  fifo->node_cache_max = max_size > 0 && max_size < NODE_CACHE_MAX ? max_size : NODE_CACHE_MAX;
   fifo->first = NULL;
   fifo->current = NULL;
   return fifo;
 }
 
-void fifo_push_internal( fifo_t *fifo, node_t *node ) {
-  dna_mutex_lock( fifo->mutex );
+/* With the mutex held, wait until a bounded fifo has room for one more item.
+   timeout_usec < 0 waits as long as it takes, 0 doesn't wait at all.
+   Returns 0 if there's still no room. */
+int fifo_wait_room_internal( fifo_t *fifo, long timeout_usec ) {
+  struct timespec deadline;
+  if ( timeout_usec > 0 ) {
+    clock_gettime( CLOCK_REALTIME, &deadline );
+    deadline.tv_sec += timeout_usec / 1000000L;
+    deadline.tv_nsec += (timeout_usec % 1000000L) * 1000L;
+    if ( deadline.tv_nsec >= 1000000000L ) {
+      deadline.tv_sec ++;
+      deadline.tv_nsec -= 1000000000L;
+    }
+  }
+  while ( fifo->max_size > 0 && fifo->size >= fifo->max_size ) {
+    if ( timeout_usec == 0 ) {
+      return 0;
+    } else if ( timeout_usec < 0 ) {
+      dna_cond_wait( fifo->wait_push, fifo->mutex );
+    } else if ( dna_cond_timedwait( fifo->wait_push, fifo->mutex, &deadline ) == ETIMEDOUT ) {
+      return fifo->size < fifo->max_size;
+    }
+  }
+  return 1;
+}
+
+/* Append one item. The caller holds the lock and has made room. */
+void fifo_link_internal( fifo_t *fifo, void *item ) {
+  node_t *node = node_alloc( fifo, item );
   assert( node != NULL );
   if ( fifo_is_empty( fifo ) ) {
     fifo->first = node;
@@ -81,35 +159,45 @@ void fifo_push_internal( fifo_t *fifo, node_t *node ) {
     fifo->current = node;
   }
   fifo->size ++;
+}
+
+/* Link the item in, waiting for room as fifo_wait_room_internal() describes.
+   Returns 0 if there was no room. */
+int fifo_push_internal( fifo_t *fifo, void *item, long timeout_usec ) {
+  dna_mutex_lock( fifo->mutex );
+  if ( !fifo_wait_room_internal( fifo, timeout_usec ) ) {
+    dna_mutex_unlock( fifo->mutex );
+    return 0;
+  }
+  fifo_link_internal( fifo, item );
   dna_cond_signal( fifo->wait_pop );
   dna_mutex_unlock( fifo->mutex );
+  return 1;
 }
 
-node_t *fifo_pop_internal( fifo_t *fifo ) {
+void *fifo_pop_internal( fifo_t *fifo ) {
   node_t *node = NULL;
+  void *data = NULL;
   dna_mutex_lock( fifo->mutex );
-  int cond_tries = 0;
   while ( fifo_is_empty(fifo) ) {
-    cond_tries ++;
-    dna_log(VERBOSE, "[tries: %i, size:%lu] fifo '%s' still empty, waiting for signal.", 
-        cond_tries, fifo->size, fifo->name );
-    /* unlock and then wait to be signalled - this is a cancellation point
-     the challenge is: if we don't break out of this other than when
-     there is an item in the queue, we will block for destroy...
-     So we should push a NULL task. */
+    /* unlock and then wait to be signalled by the next push - this is a
+     cancellation point. Nothing else wakes us: pool workers don't block
+     here (they fifo_try_pop() and park on the pool's futex, and exit
+     through that), so a caller that needs to stop a waiter pushes it a
+     sentinel. Spurious wakeups just go round again. */
     dna_cond_wait( fifo->wait_pop, fifo->mutex );
-    if ( !fifo_is_empty(fifo) ) {
-      break;
-    } else {
-      dna_log(VERBOSE, "[<%i>] predicate is still null! Spurious wakeup?", cond_tries);
-    }
   }
   assert( !fifo_is_empty(fifo) );
   node = fifo->first;
   fifo->first = node->next; /* even if it's NULL (end of the list) */
   fifo->size --;
+  if ( fifo->max_size > 0 ) {
+    dna_cond_signal( fifo->wait_push );
+  }
+  data = node->data;
+  node_release( fifo, node );
   dna_mutex_unlock( fifo->mutex );
-  return node;
+  return data;
 }
 
 /* FIXME: leads to a deadlock currently */
@@ -121,20 +209,54 @@ int fifo_is_empty( fifo_t *fifo ) {
   return empty;
 }
 
+/* Blocks while a bounded fifo is full */
 void fifo_push( fifo_t * fifo, void *item ) {
-  node_t *node = node_create( item );
-  fifo_push_internal( fifo, node );
+  fifo_push_internal( fifo, item, -1 );
+}
+
+/* Push 'count' items, in order, under one lock and with one wakeup. A bounded
+   fifo that fills up part way hands what it has to the poppers, and waits. */
+void fifo_push_n( fifo_t *fifo, void **items, long count ) {
+  long i = 0;
+  dna_mutex_lock( fifo->mutex );
+  while ( i < count ) {
+    if ( fifo->max_size > 0 && fifo->size >= fifo->max_size ) {
+      dna_cond_broadcast( fifo->wait_pop );
+      fifo_wait_room_internal( fifo, -1 );
+    }
+    fifo_link_internal( fifo, items[i++] );
+  }
+  if ( count > 1 ) {
+    dna_cond_broadcast( fifo->wait_pop );
+  } else if ( count == 1 ) {
+    dna_cond_signal( fifo->wait_pop );
+  }
+  dna_mutex_unlock( fifo->mutex );
+}
+
+/* Returns 0 instead of waiting if a bounded fifo is full */
+int fifo_try_push( fifo_t *fifo, void *item ) {
+  return fifo_push_timed( fifo, item, 0 );
+}
+
+/* Waits up to timeout_usec for room, returns 0 if none came up */
+int fifo_push_timed( fifo_t *fifo, void *item, long timeout_usec ) {
+  return fifo_push_internal( fifo, item, timeout_usec < 0 ? 0 : timeout_usec );
 }
 
 void *fifo_pop( fifo_t *fifo ) {
-  node_t *node = fifo_pop_internal( fifo );
-  if (node) {
-    void *data = node->data;
-    node_destroy(node);
-    return data;
-  } else {
-    return NULL;
+  return fifo_pop_internal( fifo );
+}
+
+/* Like fifo_pop(), but returns NULL instead of waiting when the fifo is empty. */
+void *fifo_try_pop( fifo_t *fifo ) {
+  void *data = NULL;
+  dna_mutex_lock( fifo->mutex );
+  if ( !fifo_is_empty( fifo ) ) {
+    data = fifo_pop_internal( fifo );
   }
+  dna_mutex_unlock( fifo->mutex );
+  return data;
 }
 
 long fifo_count( fifo_t *fifo ) {
@@ -157,7 +279,7 @@ void fifo_empty( fifo_t *fifo ) {
     node_t *node = fifo->first;
     if (node) {
       node_t *next = node->next;
-      node_destroy(node);
+      node_release( fifo, node );
       if (next) {
         fifo->first = next;
       } else {
@@ -168,6 +290,7 @@ void fifo_empty( fifo_t *fifo ) {
   fifo->first = NULL;
   fifo->current = NULL;
   fifo->size = 0;
+  dna_cond_broadcast( fifo->wait_push );
   dna_mutex_unlock( fifo->mutex );
 }
 
@@ -202,9 +325,16 @@ void fifo_destroy( fifo_t *fifo ) {
   if (fifo) {
     dna_log(DEBUG, "Destroying fifo %s...", fifo->name);
     fifo_empty( fifo );
+    while ( fifo->node_chunks ) {
+      node_chunk_t *chunk = fifo->node_chunks;
+      fifo->node_chunks = chunk->next;
+      free( chunk );
+    }
     dna_cond_destroy( fifo->wait_pop );
+    dna_cond_destroy( fifo->wait_push );
     dna_mutex_destroy( fifo->mutex );
     free( fifo->wait_pop );
+    free( fifo->wait_push );
     free( fifo->mutex );
     free( fifo );
   }
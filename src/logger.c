@@ -1,11 +1,11 @@
 #include <stdlib.h>
 #include <stdarg.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "logger.h"
 
-/* color + actual length + RESET */
-#define LABEL_LENGTH 6+6+6 
-
 /* Define colors for log line headers */
 #define KNRM  "\x1B[0m"
 #define KRED  "\x1B[31m"
@@ -24,50 +24,203 @@
 #define DEBUG_LABEL KMAG"DEBUG:"RESET
 #define VERBOSE_LABEL KCYN"VERBO:"RESET
 
-void log_label_internal(const char *label, const char *fmt, char *dest) {
-  strncat( dest, label, LABEL_LENGTH );
-  strncat( dest, fmt, strlen(fmt) );
-  strncat( dest, "\n", 1 );
+/* the writer's output batch */
+#define LOG_BATCH_SIZE (64 * 1024)
+/* how long the writer naps when it finds nothing, growing while it stays idle */
+#define LOG_IDLE_USEC_MIN 1000
+#define LOG_IDLE_USEC_MAX 50000
+
+typedef struct log_record_t log_record_t;
+typedef struct log_ring_t log_ring_t;
+
+struct log_record_t {
+  int level;
+  char text[LOG_RECORD_SIZE];
+};
+
+/*
+ - log_ring_t
+   Single producer (the thread that owns it), single consumer (whoever holds
+   log_write_mutex). Rings are never freed: when its thread exits, a ring is
+   up for adoption by the next thread that logs.
+*/
+struct log_ring_t {
+  _Alignas(64) atomic_ulong head; // producer: next record to fill
+  _Alignas(64) atomic_ulong tail; // consumer: next record to write out
+  atomic_ulong dropped;
+  atomic_int owned;
+  log_ring_t *next; // every ring ever made, newest first
+  log_record_t records[LOG_RING_SIZE];
+};
+
+atomic_int dna_log_threshold = GLOBAL_LOG_LEVEL;
+
+static log_ring_t *_Atomic log_rings = NULL;
+static _Thread_local log_ring_t *log_ring = NULL;
+static pthread_once_t log_once = PTHREAD_ONCE_INIT;
+static pthread_key_t log_key;
+/* The logger can't use dna_mutex_*(): they log. */
+static pthread_mutex_t log_write_mutex = PTHREAD_MUTEX_INITIALIZER;
+static unsigned long log_dropped_reported = 0;
+static atomic_int log_exiting = 0;
+
+const char *log_label_internal( int level ) {
+  switch ( level ) {
+    case INFO: return INFO_LABEL;
+    case WARN: return WARN_LABEL;
+    case ERROR: return ERROR_LABEL;
+    case DEBUG: return DEBUG_LABEL;
+    case VERBOSE: return VERBOSE_LABEL;
+    default: return "";
+  }
+}
+
+void log_write_all_internal( const char *buffer, size_t length ) {
+  while ( length > 0 ) {
+    ssize_t written = write( STDOUT_FILENO, buffer, length );
+    if ( written <= 0 ) {
+      return;
+    }
+    buffer += written;
+    length -= written;
+  }
+}
+
+/* Append one line to the batch, writing the batch out first if it's full */
+void log_append_internal( char *batch, size_t *length, const char *label, const char *text ) {
+  if ( *length + LOG_RECORD_SIZE + 32 > LOG_BATCH_SIZE ) {
+    log_write_all_internal( batch, *length );
+    *length = 0;
+  }
+  int n = snprintf( batch + *length, LOG_BATCH_SIZE - *length, "%s%s\n", label, text );
+  if ( n > 0 ) {
+    *length += n;
+  }
+}
+
+/* Write out whatever every ring holds. Returns how many records that was. */
+long log_drain_internal() {
+  static char batch[LOG_BATCH_SIZE];
+  size_t length = 0;
+  long count = 0;
+  unsigned long dropped = 0;
+  pthread_mutex_lock( &log_write_mutex );
+  log_ring_t *ring = NULL;
+  for ( ring = atomic_load( &log_rings ); ring; ring = ring->next ) {
+    unsigned long tail = atomic_load_explicit( &ring->tail, memory_order_relaxed );
+    unsigned long head = atomic_load_explicit( &ring->head, memory_order_acquire );
+    for ( ; tail != head; tail++ ) {
+      log_record_t *record = &ring->records[tail & (LOG_RING_SIZE - 1)];
+      log_append_internal( batch, &length, log_label_internal( record->level ), record->text );
+      count++;
+    }
+    atomic_store_explicit( &ring->tail, tail, memory_order_release );
+    dropped += atomic_load_explicit( &ring->dropped, memory_order_relaxed );
+  }
+  if ( dropped > log_dropped_reported ) {
+    char text[64];
+    snprintf( text, sizeof(text), "%lu log records dropped", dropped - log_dropped_reported );
+    log_append_internal( batch, &length, WARN_LABEL, text );
+    log_dropped_reported = dropped;
+  }
+  log_write_all_internal( batch, length );
+  pthread_mutex_unlock( &log_write_mutex );
+  return count;
+}
+
+void *log_writer_internal( void *arg ) {
+  long idle_usec = LOG_IDLE_USEC_MIN;
+  while ( !atomic_load( &log_exiting ) ) {
+    if ( log_drain_internal() ) {
+      idle_usec = LOG_IDLE_USEC_MIN;
+      continue;
+    }
+    struct timespec nap = { 0, idle_usec * 1000L };
+    nanosleep( &nap, NULL );
+    if ( idle_usec < LOG_IDLE_USEC_MAX ) {
+      idle_usec *= 2;
+    }
+  }
+  return NULL;
+}
+
+/* The thread is gone: its ring is free for the next thread that logs */
+void log_ring_release_internal( void *arg ) {
+  log_ring_t *ring = (log_ring_t*) arg;
+  atomic_store( &ring->owned, 0 );
+}
+
+/* At exit: stop the writer, and write out what's left ourselves */
+void log_exit_internal() {
+  atomic_store( &log_exiting, 1 );
+  log_drain_internal();
+}
+
+void log_init_internal() {
+  pthread_key_create( &log_key, &log_ring_release_internal );
+  pthread_t writer;
+  pthread_create( &writer, NULL, &log_writer_internal, NULL );
+  pthread_detach( writer );
+  atexit( &log_exit_internal );
+}
+
+log_ring_t *log_ring_acquire_internal() {
+  pthread_once( &log_once, &log_init_internal );
+  log_ring_t *ring = NULL;
+  for ( ring = atomic_load( &log_rings ); ring; ring = ring->next ) {
+    int unowned = 0;
+    if ( atomic_compare_exchange_strong( &ring->owned, &unowned, 1 ) ) {
+      break;
+    }
+  }
+  if ( !ring ) {
+    ring = (log_ring_t*) aligned_alloc( 64, sizeof(log_ring_t) );
+    atomic_init( &ring->head, 0 );
+    atomic_init( &ring->tail, 0 );
+    atomic_init( &ring->dropped, 0 );
+    atomic_init( &ring->owned, 1 );
+    ring->next = atomic_load( &log_rings );
+    while ( !atomic_compare_exchange_weak( &log_rings, &ring->next, ring ) );
+  }
+  pthread_setspecific( log_key, ring );
+  log_ring = ring;
+  return ring;
+}
+
+/* Only reached through dna_log(), once the level check has passed */
+void dna_log_write( log_level_t level, const char *fmt, ... ) {
+  log_ring_t *ring = log_ring ? log_ring : log_ring_acquire_internal();
+  unsigned long head = atomic_load_explicit( &ring->head, memory_order_relaxed );
+  if ( head - atomic_load_explicit( &ring->tail, memory_order_acquire ) >= LOG_RING_SIZE ) {
+    atomic_fetch_add_explicit( &ring->dropped, 1, memory_order_relaxed );
+    return;
+  }
+  log_record_t *record = &ring->records[head & (LOG_RING_SIZE - 1)];
+  record->level = level;
+  va_list args;
+  va_start( args, fmt );
+  vsnprintf( record->text, LOG_RECORD_SIZE, fmt, args );
+  va_end( args );
+  atomic_store_explicit( &ring->head, head + 1, memory_order_release );
+}
+
+void dna_log_set_level( log_level_t level ) {
+  atomic_store( &dna_log_threshold, level );
+}
+
+log_level_t dna_log_get_level() {
+  return (log_level_t) atomic_load( &dna_log_threshold );
+}
+
+void dna_log_flush() {
+  log_drain_internal();
 }
 
-void dna_log( log_level_t level, const char *fmt, ... ) {
-  /* cut out into a no-op as soon as possible if we aren't at a suitable logging level */
-  if ( level <= GLOBAL_LOG_LEVEL ) {
-    va_list args;
-    /* Appending \n and one of xx_LABEL, so make room */
-    size_t length = strlen(fmt) + 1 + LABEL_LENGTH;
-    char *dest = (char*) malloc(length);
-    memset(dest, 0, length);
-    va_start(args, fmt);
-      switch (level) {
-        case INFO: {
-        log_label_internal(INFO_LABEL, fmt, dest);
-        vprintf(dest, args);
-          break;
-        }
-        case WARN: {
-          log_label_internal(WARN_LABEL, fmt, dest);
-          vprintf(dest, args);
-          break;
-        }
-        case ERROR: {
-          log_label_internal(ERROR_LABEL, fmt, dest);
-          vprintf(dest, args);
-          break;
-        }
-        case DEBUG: {
-          log_label_internal(DEBUG_LABEL, fmt, dest);
-          vprintf(dest, args);
-          break;
-        }
-        case VERBOSE: {
-          log_label_internal(VERBOSE_LABEL, fmt, dest);
-          vprintf(dest, args);
-          break;
-        }
-        default: break;
-      }
-    va_end(args);
-    free(dest);
+unsigned long dna_log_dropped() {
+  unsigned long dropped = 0;
+  log_ring_t *ring = NULL;
+  for ( ring = atomic_load( &log_rings ); ring; ring = ring->next ) {
+    dropped += atomic_load_explicit( &ring->dropped, memory_order_relaxed );
   }
+  return dropped;
 }
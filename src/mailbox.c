@@ -0,0 +1,74 @@
+#include <stdlib.h>
+#include <stdatomic.h>
+
+#include "mailbox.h"
+#include "logger.h"
+
+mailbox_t *mailbox_create( const char *name ) {
+  mailbox_t *mailbox = (mailbox_t*) aligned_alloc( 64, sizeof(mailbox_t) );
+  mailbox->name = name;
+  atomic_init( &mailbox->stub.next, NULL );
+  atomic_init( &mailbox->head, &mailbox->stub );
+  atomic_init( &mailbox->tail, &mailbox->stub );
+  return mailbox;
+}
+
+/* Wait-free for producers: one exchange on head, then link the old head to us.
+   Between those two steps the consumer can see a gap, see mailbox_pop(). */
+void mailbox_push( mailbox_t *mailbox, mailbox_node_t *node ) {
+  atomic_store_explicit( &node->next, NULL, memory_order_relaxed );
+  mailbox_node_t *prev = atomic_exchange( &mailbox->head, node );
+  atomic_store_explicit( &prev->next, node, memory_order_release );
+}
+
+/* Same as mailbox_push(), for a chain the caller linked from 'first' to 'last'
+   through their 'next' pointers: it goes in whole, with a single exchange. */
+void mailbox_push_chain( mailbox_t *mailbox, mailbox_node_t *first, mailbox_node_t *last ) {
+  atomic_store_explicit( &last->next, NULL, memory_order_relaxed );
+  mailbox_node_t *prev = atomic_exchange( &mailbox->head, last );
+  atomic_store_explicit( &prev->next, first, memory_order_release );
+}
+
+mailbox_node_t *mailbox_pop( mailbox_t *mailbox ) {
+  mailbox_node_t *tail = atomic_load_explicit( &mailbox->tail, memory_order_relaxed );
+  mailbox_node_t *next = atomic_load_explicit( &tail->next, memory_order_acquire );
+  if ( tail == &mailbox->stub ) {
+    if ( !next ) {
+      return NULL;
+    }
+    atomic_store_explicit( &mailbox->tail, next, memory_order_relaxed );
+    tail = next;
+    next = atomic_load_explicit( &next->next, memory_order_acquire );
+  }
+  if ( next ) {
+    atomic_store_explicit( &mailbox->tail, next, memory_order_relaxed );
+    return tail;
+  }
+  if ( tail != atomic_load( &mailbox->head ) ) {
+    /* a producer has swapped head but not linked it yet */
+    return NULL;
+  }
+  /* tail is the last node: put the stub behind it so tail can move on */
+  mailbox_push( mailbox, &mailbox->stub );
+  next = atomic_load_explicit( &tail->next, memory_order_acquire );
+  if ( next ) {
+    atomic_store_explicit( &mailbox->tail, next, memory_order_relaxed );
+    return tail;
+  }
+  return NULL;
+}
+
+/* Exact for the consumer. Anyone else, e.g. a worker that has just handed
+   back an actor's 'scheduled' flag, gets a snapshot that may be stale. */
+int mailbox_is_empty( mailbox_t *mailbox ) {
+  return atomic_load_explicit( &mailbox->tail, memory_order_relaxed ) == &mailbox->stub &&
+         atomic_load( &mailbox->head ) == &mailbox->stub;
+}
+
+/* The mailbox doesn't own its nodes; drain it before destroying it. */
+void mailbox_destroy( mailbox_t *mailbox ) {
+  if (mailbox) {
+    dna_log(DEBUG, "Destroying mailbox %s...", mailbox->name);
+    free( mailbox );
+  }
+}
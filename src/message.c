@@ -1,4 +1,5 @@
 #include  <stdlib.h>
+#include  <string.h>
 
 #include "message.h"
 #include "logger.h"
@@ -8,21 +9,117 @@ static long messageId = 0;
 /* Actor system should be the only one repsonsible for
    creating, storing, retreiving or freeing messages */
 message_t *message_create(void *data, int type, actor_t *from) {
-  message_t *message = (message_t*) malloc( sizeof(message_t) );
+  return message_create_sized( 0, data, type, from );
+}
+
+message_t *message_create_sized(size_t payload_capacity, void *data, int type, actor_t *from) {
+  message_t *message = (message_t*) malloc( sizeof(message_t) + payload_capacity );
+  message_init( message, data, type, from );
+  message->payload_capacity = payload_capacity;
+  return message;
+}
+
+/* For messages whose memory is someone else's, like the actor system's arena */
+void message_init(message_t *message, void *data, int type, actor_t *from) {
   message->data = data;
   message->type = type;
   message->promise = NULL;
   message->from = from;
+  message->pool_next = NULL;
+  message->flags = 0;
+  message->payload_capacity = 0;
+  message->payload_size = 0;
   message->id = ++messageId;
   if (message->id % 1000 == 0) {
     dna_log(DEBUG, "New message created. Reached new message id : %lu", message->id );
   }
-  return message;
+}
+
+message_shared_t *message_shared_create(const void *payload, size_t size) {
+  message_shared_t *shared = (message_shared_t*) malloc( sizeof(message_shared_t) + size );
+  atomic_init( &shared->refs, 1 );
+  shared->size = size;
+  memcpy( shared->data, payload, size );
+  return shared;
+}
+
+message_shared_t *message_shared_retain(message_shared_t *shared) {
+  atomic_fetch_add_explicit( &shared->refs, 1, memory_order_relaxed );
+  return shared;
+}
+
+void message_shared_release(message_shared_t *shared) {
+  if ( atomic_fetch_sub( &shared->refs, 1 ) == 1 ) {
+    free( shared );
+  }
+}
+
+message_shared_t *message_shared_internal(message_t *message) {
+  return (message_shared_t*) ((char*) message->data - offsetof(message_shared_t, data));
+}
+
+void message_release_data(message_t *message) {
+  if ( message->flags & MESSAGE_OWNS_DATA ) {
+    free( message->data );
+    message->flags &= ~MESSAGE_OWNS_DATA;
+  } else if ( message->flags & MESSAGE_SHARED_DATA ) {
+    /* never NULL while the flag is set, but saying so keeps gcc from
+       warning about freeing 'NULL - offsetof(...)' once this is inlined */
+    if ( message->data ) {
+      message_shared_release( message_shared_internal( message ) );
+    }
+    message->flags &= ~MESSAGE_SHARED_DATA;
+  }
+  message->data = NULL;
+  message->payload_size = 0;
+}
+
+void message_set_payload(message_t *message, const void *payload, size_t size) {
+  message_release_data( message );
+  if ( size <= message->payload_capacity ) {
+    message->data = message->payload;
+  } else {
+    message->data = malloc( size );
+    message->flags |= MESSAGE_OWNS_DATA;
+  }
+  memcpy( message->data, payload, size );
+  message->payload_size = size;
+}
+
+void message_set_shared(message_t *message, message_shared_t *shared) {
+  message_release_data( message );
+  message->data = shared->data;
+  message->payload_size = shared->size;
+  message->flags |= MESSAGE_SHARED_DATA;
+}
+
+void message_move_data(message_t *to, message_t *from) {
+  message_release_data( to );
+  if ( from->data == from->payload ) {
+    message_set_payload( to, from->payload, from->payload_size );
+    return;
+  }
+  unsigned int owned = from->flags & (MESSAGE_OWNS_DATA | MESSAGE_SHARED_DATA);
+  to->data = from->data;
+  to->payload_size = from->payload_size;
+  to->flags |= owned;
+  from->flags &= ~owned;
+}
+
+void message_set_priority(message_t *message, int priority) {
+  if ( priority ) {
+    message->flags |= MESSAGE_PRIORITY;
+  } else {
+    message->flags &= ~MESSAGE_PRIORITY;
+  }
 }
 
 void message_destroy(message_t *message) {
+  message_release_data( message );
   promise_destroy( message->promise );
   message->promise = NULL;
-  free( message );
+  if ( !(message->flags & MESSAGE_FROM_ARENA) ) {
+    free( message );
+  }
 }
 
@@ -1,81 +1,272 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <limits.h>
 
-#include "fifo.h"
 #include "promise.h"
+#include "threads.h"
+#include "thread_pool.h"
 #include "logger.h"
+#include "trace.h"
 
-typedef enum {
-  VALUE = 0,
-  PROMISE_CHAIN = 1
-} value_type_t;
+typedef struct promise_counter_t promise_counter_t;
 
-typedef struct {
-  void* value;
-  value_type_t type;
-} value_t;
+/* Promise counts, kept per thread so that creating a promise never contends
+   with another thread; promise_counts() adds them up. Never freed: they hold
+   the counts of threads that have exited. */
+struct promise_counter_t {
+  _Alignas(64) atomic_long created;
+  atomic_long freed;
+  promise_counter_t *next;
+};
 
-promise_t * promise_create() {
+static promise_counter_t *_Atomic promise_counters = NULL;
+static _Thread_local promise_counter_t *promise_counter = NULL;
+
+/* Only the owning thread writes its counter (see dna_count()) */
+void promise_count_internal( int freed ) {
+  promise_counter_t *counter = promise_counter;
+  if ( !counter ) {
+    counter = (promise_counter_t*) aligned_alloc( 64, sizeof(promise_counter_t) );
+    atomic_init( &counter->created, 0 );
+    atomic_init( &counter->freed, 0 );
+    counter->next = atomic_load( &promise_counters );
+    while ( !atomic_compare_exchange_weak( &promise_counters, &counter->next, counter ) );
+    promise_counter = counter;
+  }
+  dna_count( freed ? &counter->freed : &counter->created, 1 );
+}
+
+void promise_counts( long *created, long *live ) {
+  long made = 0;
+  long freed = 0;
+  promise_counter_t *counter = NULL;
+  for ( counter = atomic_load( &promise_counters ); counter; counter = counter->next ) {
+    made += atomic_load_explicit( &counter->created, memory_order_relaxed );
+    freed += atomic_load_explicit( &counter->freed, memory_order_relaxed );
+  }
+  *created = made;
+  *live = made - freed;
+}
+
+promise_t *promise_alloc_internal( promise_state_t state, void *resolution ) {
+  promise_count_internal( 0 );
   promise_t *promise = (promise_t*) malloc( sizeof(promise_t) );
-  promise->fifo = fifo_create("promise", 1);
-  promise->state = PROMISE_WAITING;
+  promise->id = 0;
+  promise->resolution = resolution;
+  promise->next = NULL;
+  promise->then = NULL;
+  promise->then_arg = NULL;
+  atomic_init( &promise->state, state );
+  atomic_init( &promise->refs, 1 );
   return promise;
 }
 
+promise_t * promise_create() {
+  return promise_alloc_internal( PROMISE_WAITING, NULL );
+}
+
 promise_t *promise_resolved( void *resolved_value ) {
-  promise_t *promise = (promise_t*) malloc( sizeof(promise_t) );
-  promise->fifo = NULL;
-  promise->state = PROMISE_RESOLVED;
-  promise->resolution = resolved_value;
+  return promise_alloc_internal( PROMISE_RESOLVED, resolved_value );
+}
+
+/* Take another reference, for a second holder that will promise_destroy() it */
+promise_t *promise_retain( promise_t *promise ) {
+  atomic_fetch_add_explicit( &promise->refs, 1, memory_order_relaxed );
   return promise;
 }
 
-/* Results in a Cons style list of fifos. [1,[2,[3,[4,[5,[value]]]]]]
- Would it be more optimal to simply chain all promises as elements in the same list?
- - TODO: evaluate this idea - expand the promise type and push each promise in order to the list
- - Notwithstanding aliasing issues, perhaps we could point each promise at the same fifo? */
+promise_state_t promise_state( promise_t *promise ) {
+  return (promise_state_t) (atomic_load( &promise->state ) & PROMISE_STATE_MASK);
+}
+
+/* A continuation's task: owns the reference promise_then() was given */
+void *promise_then_task_internal( void *arg ) {
+  promise_t *promise = (promise_t*) arg;
+  promise->then( promise->resolution, promise->then_arg );
+  promise_destroy( promise );
+  return NULL;
+}
+
+/* Hand a resolved promise's continuation to the pool we're running on, so the
+   resolver (usually an actor's receive loop) doesn't pay for it. */
+void promise_dispatch_internal( promise_t *promise ) {
+  thread_pool_t *pool = thread_pool_current();
+  if ( pool ) {
+    thread_pool_enqueue( pool, &promise_then_task_internal, promise );
+  } else {
+    promise_then_task_internal( promise );
+  }
+}
+
+/* Is the promise's value still to come? */
+int promise_pending_internal( int state ) {
+  state &= PROMISE_STATE_MASK;
+  return state == PROMISE_WAITING || state == PROMISE_SETTING;
+}
+
+/* Take a waiting promise for ourselves, keeping its flags, so that nobody else
+   settles it while we fill in its resolution or next. Returns 0 if it wasn't
+   PROMISE_WAITING any more. */
+int promise_claim_internal( promise_t *promise ) {
+  int old = atomic_load( &promise->state );
+  do {
+    if ( (old & PROMISE_STATE_MASK) != PROMISE_WAITING ) {
+      return 0;
+    }
+  } while ( !atomic_compare_exchange_weak( &promise->state, &old,
+              (old & ~PROMISE_STATE_MASK) | PROMISE_SETTING ) );
+  return 1;
+}
+
+/* A promise someone else claimed will be settled in a moment: wait it out,
+   and return the state it settled in. */
+int promise_settled_internal( promise_t *promise ) {
+  int state = 0;
+  while ( ((state = atomic_load( &promise->state )) & PROMISE_STATE_MASK) == PROMISE_SETTING ) {
+    dna_cpu_relax();
+  }
+  return state & PROMISE_STATE_MASK;
+}
+
+/* Move a promise we claimed to its final state, and only make the syscall if
+   a getter is asleep. Flags raised while we held the claim count too. */
+void promise_settle_internal( promise_t *promise, promise_state_t state ) {
+  int old = atomic_exchange( &promise->state, state );
+  if ( old & PROMISE_WAITERS ) {
+    dna_futex_wake( &promise->state, INT_MAX );
+  }
+  if ( old & PROMISE_THEN ) {
+    if ( state == PROMISE_CHAINED ) {
+      /* our value goes on to 'next', and so does the continuation, with the
+         reference promise_then() left us */
+      promise_then( promise_retain( promise->next ), promise->then, promise->then_arg );
+      promise_destroy( promise );
+    } else {
+      promise_dispatch_internal( promise );
+    }
+  }
+}
+
+/* The promise a value given to 'promise' will actually land in. Every hop is
+   kept alive by the reference the previous one holds. */
+promise_t *promise_target_internal( promise_t *promise ) {
+  while ( promise_state( promise ) == PROMISE_CHAINED ) {
+    promise = promise->next;
+  }
+  return promise;
+}
+
+/* Chained promises used to be a Cons style list of fifos. [1,[2,[3,[4,[5,[value]]]]]]
+   Now, promise1 resolves to whatever promise2 resolves to, with no list at all:
+   promise2 forwards straight to promise1's final target. If promise2 has
+   already resolved, its value goes there right away; if it was already
+   chained, the end of its own chain forwards to the target instead.
+   Takes over the caller's reference to promise2. */
 void promise_chain( promise_t *promise1, promise_t *promise2 ) {
-  value_t *value = (value_t*) malloc( sizeof(value_t) );
-  value->type = PROMISE_CHAIN;
-  value->value = promise2;
-  fifo_push(promise1->fifo, value);
+  promise_t *target = promise_retain( promise_target_internal( promise1 ) );
+  if ( promise_claim_internal( promise2 ) ) {
+    promise2->next = target;
+    promise_settle_internal( promise2, PROMISE_CHAINED );
+  } else if ( promise_settled_internal( promise2 ) == PROMISE_CHAINED ) {
+    promise_t *end = promise_target_internal( promise2 );
+    if ( end != target ) {
+      promise_chain( target, promise_retain( end ) );
+    }
+    promise_destroy( target );
+  } else {
+    promise_set( target, promise2->resolution );
+    promise_destroy( target );
+  }
+  promise_destroy( promise2 );
 }
 
+/* If the promise has been chained, the value goes on to the end of the chain.
+   A set can race a promise_chain() on the same promise: whichever claims it
+   first wins, and the loser hands the value along. The value is only written
+   once we hold the claim, so a second set can't touch the first one's. */
 void promise_set(promise_t *promise, void *val) {
-  value_t *value = (value_t*) malloc( sizeof(value_t) );
-  value->type = VALUE;
-  value->value = val;
-  fifo_push( promise->fifo, value );
-  promise->state = PROMISE_RESOLVED;
+  for (;;) {
+    promise = promise_target_internal( promise );
+    if ( promise_claim_internal( promise ) ) {
+      promise->resolution = val;
+      promise_settle_internal( promise, PROMISE_RESOLVED );
+      dna_trace( TRACE_RESOLVE, 0, 0, promise->id );
+      return;
+    }
+    if ( promise_settled_internal( promise ) != PROMISE_CHAINED ) {
+      dna_log(WARN, "promise %lu was resolved twice", promise->id);
+      return;
+    }
+  }
 }
 
-/* Returns the value from the promise and destroys it.
-   Will actually call promise_destroy() + free( promise ); */
+/* Block until this one promise is settled. */
+int promise_wait_internal( promise_t *promise ) {
+  int state = atomic_load( &promise->state );
+  while ( promise_pending_internal( state ) ) {
+    if ( !(state & PROMISE_WAITERS) ) {
+      if ( !atomic_compare_exchange_weak( &promise->state, &state, state | PROMISE_WAITERS ) ) {
+        continue;
+      }
+      state |= PROMISE_WAITERS;
+    }
+    dna_futex_wait( &promise->state, state );
+    state = atomic_load( &promise->state );
+  }
+  return state & PROMISE_STATE_MASK;
+}
+
+/* Returns the value from the promise and gives back the caller's reference.
+   Chains are flattened as they're built, so there's normally nothing to walk:
+   this only hops if the caller's own promise was chained somewhere. */
 void *promise_get( promise_t *promise ) {
-  value_t *value = (value_t*) fifo_pop( promise->fifo );
-  promise_destroy( promise );
-  long i = 1;
-  while( value->type == PROMISE_CHAIN ) {
-    i++;
-    promise_t *next = (promise_t*) value->value;
-    free( value );
-    value = (value_t*) fifo_pop( next->fifo );
-    //promise_destroy( next );
+  while ( promise_wait_internal( promise ) == PROMISE_CHAINED ) {
+    promise_t *next = promise_retain( promise->next );
+    promise_destroy( promise );
+    promise = next;
   }
-  dna_log(DEBUG, "end of promise chain %lu...", i);
-  void *val = value->value;
-  free(value);
+  void *val = promise->resolution;
+  promise_destroy( promise );
   return val;
 }
 
-void promise_destroy(promise_t *promise) {
-  if ( promise ) {
-    while ( !fifo_is_empty(promise->fifo) ) {
-      value_t *value = (value_t *) fifo_pop(promise->fifo);
-      free(value);
+void promise_then( promise_t *promise, promise_then_func_p func, void *arg ) {
+  int state = atomic_load( &promise->state );
+  for (;;) {
+    switch ( state & PROMISE_STATE_MASK ) {
+      case PROMISE_CHAINED: {
+        /* our value goes elsewhere, so does the continuation */
+        promise_t *next = promise_retain( promise->next );
+        promise_destroy( promise );
+        promise = next;
+        state = atomic_load( &promise->state );
+        break;
+      }
+      case PROMISE_WAITING:
+      case PROMISE_SETTING:
+        /* only read by the resolver once the bit is visible */
+        promise->then = func;
+        promise->then_arg = arg;
+        if ( atomic_compare_exchange_weak( &promise->state, &state, state | PROMISE_THEN ) ) {
+          return;
+        }
+        break;
+      default:
+        promise->then = func;
+        promise->then_arg = arg;
+        promise_then_task_internal( promise );
+        return;
     }
-    fifo_destroy( promise->fifo );
-    promise->fifo = NULL;
-    free(promise);
+  }
+}
+
+/* Drop a reference. Dropping the last one frees the promise, and lets go of
+   the promise it forwards to. */
+void promise_destroy(promise_t *promise) {
+  while ( promise && atomic_fetch_sub( &promise->refs, 1 ) == 1 ) {
+    promise_t *next = promise->next;
+    free( promise );
+    promise_count_internal( 1 );
+    promise = next;
   }
 }
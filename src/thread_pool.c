@@ -2,21 +2,22 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <assert.h>
+#include <limits.h>
+#include <sched.h>
 
 #include "fifo.h"
 #include "thread_pool.h"
 #include "threads.h"
 #include "logger.h"
+#include "trace.h"
 
 typedef struct {
   void* (*func)(void*);
   void *arg;
 } task_t;
 
-typedef struct {
-  fifo_t *task_list;
-  dna_thread_context_t *thread_context;
-} execution_args_t;
+/* the worker running on this thread, if it belongs to any pool */
+static _Thread_local thread_pool_worker_t *current_worker = NULL;
 
 task_t *task_create( void*(*func)(void*), void *arg ) {
   task_t *task = (task_t*) malloc( sizeof( task_t ) );
@@ -25,13 +26,6 @@ task_t *task_create( void*(*func)(void*), void *arg ) {
   return task;
 }
 
-execution_args_t *execution_args_create(thread_pool_t *pool, dna_thread_context_t *context) {
-  execution_args_t *args = (execution_args_t*) malloc(sizeof(execution_args_t));
-  args->thread_context = context;
-  args->task_list = pool->tasks;
-  return args;
-}
-
 /* Actually execute work from the thread pool. */
 void *task_execute( task_t *task ) {
   void* (*func)(void*) = task->func;
@@ -51,27 +45,166 @@ void task_destroy( task_t *task ) {
   free( task );
 }
 
+/* Shared: the one fifo first, since nobody has a claim on what's in there,
+   then what was aimed at us, then other workers' inboxes, starting from a
+   random victim. Taking the fifo first keeps an actor that reschedules
+   itself into our inbox from starving the work behind it.
+   Work-stealing: our own deque first (newest first, still warm in cache),
+   then what other threads aimed at us, then whatever was enqueued from outside
+   the pool, then the other workers' deques (oldest first) and inboxes,
+   starting from a random victim. */
+task_t *thread_pool_find_task_internal( thread_pool_worker_t *worker ) {
+  thread_pool_t *pool = worker->pool;
+  task_t *task = NULL;
+  if ( pool->mode != THREAD_POOL_WORK_STEALING ) {
+    if ( atomic_load( &pool->pending ) > 0 ) {
+      task = (task_t*) fifo_try_pop( pool->tasks );
+      if ( !task ) {
+        task = (task_t*) fifo_try_pop( worker->inbox );
+      }
+      int start = rand_r( &worker->seed ) % pool->worker_count;
+      int i = 0;
+      int local = task != NULL;
+      for ( i = 0; !task && i < pool->worker_count; i++ ) {
+        thread_pool_worker_t *victim = &pool->workers[ (start + i) % pool->worker_count ];
+        if ( victim != worker ) {
+          task = (task_t*) fifo_try_pop( victim->inbox );
+        }
+      }
+      if ( task && !local ) {
+        dna_count( &worker->steals, 1 );
+      }
+      if ( task ) {
+        atomic_fetch_sub( &pool->pending, 1 );
+      }
+    }
+    return task;
+  }
+  task = (task_t*) deque_pop( worker->deque );
+  if ( !task && atomic_load( &pool->pending ) > 0 ) {
+    task = (task_t*) fifo_try_pop( worker->inbox );
+    if ( !task ) {
+      task = (task_t*) fifo_try_pop( pool->tasks );
+    }
+    int start = rand_r( &worker->seed ) % pool->worker_count;
+    int i = 0;
+    int local = task != NULL;
+    for ( i = 0; !task && i < pool->worker_count; i++ ) {
+      thread_pool_worker_t *victim = &pool->workers[ (start + i) % pool->worker_count ];
+      if ( victim != worker ) {
+        task = (task_t*) deque_steal( victim->deque );
+      }
+    }
+    for ( i = 0; !task && i < pool->worker_count; i++ ) {
+      thread_pool_worker_t *victim = &pool->workers[ (start + i) % pool->worker_count ];
+      if ( victim != worker ) {
+        task = (task_t*) fifo_try_pop( victim->inbox );
+      }
+    }
+    if ( task && !local ) {
+      dna_count( &worker->steals, 1 );
+    }
+  }
+  if ( task ) {
+    atomic_fetch_sub( &pool->pending, 1 );
+  }
+  return task;
+}
+
+/* Is there anything for an idle worker to go and look for? */
+int thread_pool_has_work_internal( thread_pool_t *pool ) {
+  return atomic_load( &pool->pending ) > 0 || atomic_load( &pool->exiting );
+}
+
+/* Sleep on the futex until something is enqueued. 'sleeping' is raised before
+   'pending' is checked, and enqueuers raise 'pending' before they check
+   'sleeping', so at least one side always sees the other; and since wake_seq
+   is read before either, a wake in between makes the futex wait return. */
+void thread_pool_park_internal( thread_pool_worker_t *worker ) {
+  thread_pool_t *pool = worker->pool;
+  int seq = atomic_load( &pool->wake_seq );
+  atomic_fetch_add( &pool->sleeping, 1 );
+  if ( !thread_pool_has_work_internal( pool ) ) {
+    long start = dna_trace_clock();
+    dna_count( &worker->parks, 1 );
+    dna_futex_wait( &pool->wake_seq, seq );
+    dna_trace_span( TRACE_PARK, start, 0, 0, worker->index );
+  }
+  atomic_fetch_sub( &pool->sleeping, 1 );
+}
+
+/* Wake up to 'count' parked workers, if there are any: otherwise this costs
+   enqueuers one load. */
+void thread_pool_wake_internal( thread_pool_t *pool, int count ) {
+  if ( atomic_load( &pool->sleeping ) > 0 ) {
+    atomic_fetch_add( &pool->wake_seq, 1 );
+    dna_futex_wake( &pool->wake_seq, count );
+  }
+}
+
+/* Nothing to do: spin a while, then yield a while, and only then park. Work
+   usually turns up within microseconds on a busy pool, and a futex round trip
+   costs more than that. The spin adapts: it doubles each time spinning pays
+   off, and halves each time we end up parked anyway. */
+void thread_pool_idle_internal( thread_pool_worker_t *worker ) {
+  thread_pool_t *pool = worker->pool;
+  int i = 0;
+  for ( i = 0; i < worker->spin; i++ ) {
+    if ( thread_pool_has_work_internal( pool ) ) {
+      if ( worker->spin < THREAD_POOL_SPIN_MAX ) {
+        worker->spin *= 2;
+      }
+      return;
+    }
+    dna_cpu_relax();
+  }
+  for ( i = 0; i < THREAD_POOL_YIELDS; i++ ) {
+    if ( thread_pool_has_work_internal( pool ) ) {
+      return;
+    }
+    sched_yield();
+  }
+  if ( worker->spin > THREAD_POOL_SPIN_MIN ) {
+    worker->spin /= 2;
+  }
+  thread_pool_park_internal( worker );
+}
+
 /**
 * Until pthread_exit, pull a task_t out of the task queue and run it on our thread
 */
 void *execute_task_thread_internal( void *args ) {
-  execution_args_t *yargs = (execution_args_t*) args;
-  fifo_t *tasks = yargs->task_list;
-  dna_thread_context_t *context = yargs->thread_context;
-  free( yargs );
+  thread_pool_worker_t *worker = (thread_pool_worker_t*) args;
+  thread_pool_t *pool = worker->pool;
+  dna_thread_context_t *context = worker->context;
+  current_worker = worker;
+  dna_trace_name_thread( pool->name, worker->index );
   dna_log(DEBUG, "started execution of thread %lu", context->id);
   task_t *task = NULL;
-  while ( !dna_thread_context_should_exit(context) &&
-          (task = (task_t*) fifo_pop( tasks ) ) ) {
-
-    if ( task->func ) { // thread_pool_destroy sends tasks which have NULL members in, don't bother executing it
+  while ( !dna_thread_context_should_exit(context) ) {
+    if ( !(task = thread_pool_find_task_internal( worker )) ) {
+      if ( atomic_load( &pool->exiting ) ) {
+        break;
+      }
+      /* only the switches between busy and idle are timed, not every task */
+      if ( !atomic_load_explicit( &worker->idle_since, memory_order_relaxed ) ) {
+        atomic_store_explicit( &worker->idle_since, dna_time_usec(), memory_order_relaxed );
+      }
+      thread_pool_idle_internal( worker );
+      continue;
+    }
+    long idle_since = atomic_load_explicit( &worker->idle_since, memory_order_relaxed );
+    if ( idle_since ) {
+      dna_count( &worker->idle_usec, dna_time_usec() - idle_since );
+      atomic_store_explicit( &worker->idle_since, 0, memory_order_relaxed );
+    }
+    dna_count( &worker->tasks, 1 );
+    if ( task->func ) {
       task_execute(task);
     }
     task_destroy( task );
-    if (dna_thread_context_should_exit(context)) {
-      break;
-    }
   }
+  current_worker = NULL;
   dna_log(DEBUG, "Execution of thread %lu has finished.", context->id );
   return NULL;
 }
@@ -81,51 +214,86 @@ void *execute_task_thread_internal( void *args ) {
 * Starts consuming threads immediately.
 */
 thread_pool_t *thread_pool_create( const char *name, int thread_count ) {
-  assert( thread_count > 0 );
+  return thread_pool_create_mode( name, thread_count, THREAD_POOL_SHARED );
+}
+
+thread_pool_t *thread_pool_create_mode( const char *name, int thread_count, thread_pool_mode_t mode ) {
+  if ( thread_count <= 0 ) {
+    thread_count = dna_cpu_count();
+  }
   thread_pool_t *pool = (thread_pool_t*) malloc( sizeof( thread_pool_t ) );
   pool->mutex = (pthread_mutex_t*) malloc(sizeof(pthread_mutex_t));
   dna_mutex_init(pool->mutex);
   pool->wait = (pthread_cond_t*) malloc(sizeof(pthread_cond_t));
   dna_cond_init(pool->wait);
+  atomic_init( &pool->wake_seq, 0 );
+  atomic_init( &pool->pending, 0 );
+  atomic_init( &pool->sleeping, 0 );
+  atomic_init( &pool->exiting, 0 );
   pool->name = name;
-  pool->tasks = fifo_create("(tasks)", 50 );
+  pool->mode = mode;
+  pool->tasks = fifo_create("(tasks)", 0 /* workers enqueue too; they must never block on it */ );
   pool->thread_queue = fifo_create("(threads)", thread_count );
+  pool->worker_count = thread_count;
+  pool->workers = (thread_pool_worker_t*) calloc( thread_count, sizeof(thread_pool_worker_t) );
   int i = 0;
+  /* every worker has to exist before any of them starts stealing */
+  for ( i = 0; i < thread_count; i++ ) {
+    thread_pool_worker_t *worker = &pool->workers[i];
+    worker->pool = pool;
+    worker->index = i;
+    worker->seed = (unsigned int) i + 1;
+    worker->spin = THREAD_POOL_SPIN_MIN;
+    atomic_init( &worker->tasks, 0 );
+    atomic_init( &worker->steals, 0 );
+    atomic_init( &worker->parks, 0 );
+    atomic_init( &worker->idle_usec, 0 );
+    atomic_init( &worker->idle_since, 0 );
+    worker->started_usec = dna_time_usec();
+    worker->deque = mode == THREAD_POOL_WORK_STEALING ? deque_create( 256 ) : NULL;
+    worker->inbox = fifo_create( "(inbox)", 0 );
+    worker->context = dna_thread_context_create(i+1);
+  }
   for ( i = 0; i < thread_count; i++ ) {
-    dna_thread_context_t *context = dna_thread_context_create(i+1);
-    execution_args_t *args = execution_args_create(pool, context);
-    dna_thread_context_execute(context, &execute_task_thread_internal, args);
-    fifo_push( pool->thread_queue, context );
+    thread_pool_worker_t *worker = &pool->workers[i];
+    dna_thread_context_execute(worker->context, &execute_task_thread_internal, worker);
+    fifo_push( pool->thread_queue, worker->context );
   }
   return pool;
 }
 
+/* One worker per CPU, in order; a no-op where the OS won't let us */
+void thread_pool_pin_workers( thread_pool_t *pool ) {
+  int i = 0;
+  for ( i = 0; i < pool->worker_count; i++ ) {
+    int code = dna_thread_pin( pool->workers[i].context->thread, i );
+    if ( code ) {
+      dna_log(WARN, "Couldn't pin worker %i of pool %s (%i).", i, pool->name, code);
+    }
+  }
+}
+
 // used to mark all threads so they will quit
 void kill_thread(void *arg) {
   dna_thread_context_t *context = (dna_thread_context_t *) arg;
   dna_thread_context_exit(context);
 }
 
-void delete_task( void *arg ) {
-  task_t *task = (task_t*)arg;
-  task_destroy(task);
-}
-
 void thread_pool_exit_all( thread_pool_t *pool ) {
   dna_mutex_lock( pool->mutex );
-  fifo_each( pool->tasks, &delete_task );
-  fifo_empty(pool->tasks);
+  /* pop them one by one, so a worker can't grab a task we already freed */
+  task_t *task = NULL;
+  while ( (task = (task_t*) fifo_try_pop( pool->tasks )) ) {
+    task_destroy( task );
+  }
   fifo_each(
       pool->thread_queue,
       &kill_thread
   );
-  /* push new "work" into the queue to unblock threads waiting on the list */
-  int x = 0;
-  for ( x = 0; x < fifo_count( pool->thread_queue ); x++) {
-    /* We guard and don't execute NULL function pointers
-       This merely meets the needs of the fifo for unblocking. */
-    thread_pool_enqueue( pool, NULL, NULL );
-  }
+  /* wake every parked worker so they notice they should quit */
+  atomic_store( &pool->exiting, 1 );
+  atomic_fetch_add( &pool->wake_seq, 1 );
+  dna_futex_wake( &pool->wake_seq, INT_MAX );
   dna_cond_signal( pool->wait );
   dna_mutex_unlock( pool->mutex );
 }
@@ -155,8 +323,8 @@ void thread_pool_join_all( thread_pool_t *pool ) {
     }
     else {
       // if the context is != RUNNING, it's either SHOULD_QUIT or HAS_QUIT
-      // so we have to rely on the null work we pushed earlier to clear
-      // any blocks
+      // so we rely on thread_pool_exit_all() having woken any parked
+      // worker to clear any blocks
       dna_thread_context_join( context );
       dna_thread_context_destroy(context);
     }
@@ -180,6 +348,26 @@ void thread_pool_destroy( thread_pool_t *pool ) {
     }
     fifo_destroy( pool->tasks );
     pool->tasks = NULL;
+    int i = 0;
+    for ( i = 0; i < pool->worker_count; i++ ) {
+      deque_t *deque = pool->workers[i].deque;
+      if ( deque ) {
+        task_t *task = NULL;
+        while ( (task = (task_t*) deque_pop( deque )) ) {
+          task_destroy( task );
+        }
+        deque_destroy( deque );
+      }
+      fifo_t *inbox = pool->workers[i].inbox;
+      if ( inbox ) {
+        task_t *task = NULL;
+        while ( (task = (task_t*) fifo_try_pop( inbox )) ) {
+          task_destroy( task );
+        }
+        fifo_destroy( inbox );
+      }
+    }
+    free( pool->workers );
     dna_log(DEBUG, "Freeing thread context pool \"%s\".", pool->name);
     dna_mutex_destroy( pool->mutex );
     dna_cond_destroy( pool->wait );
@@ -189,11 +377,101 @@ void thread_pool_destroy( thread_pool_t *pool ) {
   }
 }
 
+/* In work-stealing mode a worker enqueues onto its own deque; everyone
+   else goes through the shared fifo. */
 void thread_pool_enqueue_task( thread_pool_t *pool, task_t *task ) {
-  fifo_push( pool->tasks, task );
+  thread_pool_worker_t *worker = current_worker;
+  if ( pool->mode == THREAD_POOL_WORK_STEALING && worker && worker->pool == pool ) {
+    deque_push( worker->deque, task );
+  } else {
+    fifo_push( pool->tasks, task );
+  }
+  atomic_fetch_add( &pool->pending, 1 );
+  thread_pool_wake_internal( pool, 1 );
 }
 
 void thread_pool_enqueue( thread_pool_t *pool, void*(*func)(void*), void *arg) {
   task_t *task = task_create( func, arg );
   thread_pool_enqueue_task( pool, task );
 }
+
+/* Prefer running the task on one particular worker. In work-stealing mode,
+   straight onto its deque if that's us; otherwise, and always in shared mode,
+   into its inbox (see thread_pool_find_task_internal() for when it looks
+   there). Idle workers may still steal it from there. */
+void thread_pool_enqueue_to( thread_pool_t *pool, int index, void*(*func)(void*), void *arg ) {
+  thread_pool_worker_t *worker = current_worker;
+  if ( index < 0 || index >= pool->worker_count ) {
+    thread_pool_enqueue( pool, func, arg );
+    return;
+  }
+  int wake = 1;
+  if ( worker && worker->pool == pool && worker->index == index ) {
+    /* We'll get to it as soon as we're done. Only bring in help if it has to
+       queue behind other work; otherwise a parked worker would just steal it. */
+    if ( pool->mode == THREAD_POOL_WORK_STEALING ) {
+      deque_push( worker->deque, task_create( func, arg ) );
+      wake = deque_count( worker->deque ) > 1;
+    } else {
+      fifo_push( worker->inbox, task_create( func, arg ) );
+      wake = fifo_count( worker->inbox ) > 1 || !fifo_is_empty( pool->tasks );
+    }
+  } else {
+    fifo_push( pool->workers[index].inbox, task_create( func, arg ) );
+  }
+  atomic_fetch_add( &pool->pending, 1 );
+  if ( wake ) {
+    thread_pool_wake_internal( pool, 1 );
+  }
+}
+
+/* Enqueue func(args[i]) for each of 'count' args: one fifo lock, or one deque
+   run, per THREAD_POOL_BATCH tasks, and a single wakeup for all of them. */
+void thread_pool_enqueue_n( thread_pool_t *pool, void*(*func)(void*), void **args, long count ) {
+  task_t *tasks[THREAD_POOL_BATCH];
+  while ( count > 0 ) {
+    long n = count < THREAD_POOL_BATCH ? count : THREAD_POOL_BATCH;
+    long i = 0;
+    for ( i = 0; i < n; i++ ) {
+      tasks[i] = task_create( func, args[i] );
+    }
+    thread_pool_worker_t *worker = current_worker;
+    if ( pool->mode == THREAD_POOL_WORK_STEALING && worker && worker->pool == pool ) {
+      for ( i = 0; i < n; i++ ) {
+        deque_push( worker->deque, tasks[i] );
+      }
+    } else {
+      fifo_push_n( pool->tasks, (void**) tasks, n );
+    }
+    atomic_fetch_add( &pool->pending, n );
+    thread_pool_wake_internal( pool, (int) n );
+    args += n;
+    count -= n;
+  }
+}
+
+int thread_pool_worker_index( thread_pool_t *pool ) {
+  thread_pool_worker_t *worker = current_worker;
+  return worker && worker->pool == pool ? worker->index : -1;
+}
+
+thread_pool_t *thread_pool_current() {
+  return current_worker ? current_worker->pool : NULL;
+}
+
+/* Counters are read as they stand: each one is exact, but they can be a
+   task or so apart from one another. */
+void thread_pool_worker_stats( thread_pool_t *pool, int index, thread_pool_worker_stats_t *stats ) {
+  thread_pool_worker_t *worker = &pool->workers[index];
+  long now = dna_time_usec();
+  long idle = atomic_load_explicit( &worker->idle_usec, memory_order_relaxed );
+  long idle_since = atomic_load_explicit( &worker->idle_since, memory_order_relaxed );
+  if ( idle_since && now > idle_since ) {
+    idle += now - idle_since;
+  }
+  stats->tasks = atomic_load_explicit( &worker->tasks, memory_order_relaxed );
+  stats->steals = atomic_load_explicit( &worker->steals, memory_order_relaxed );
+  stats->parks = atomic_load_explicit( &worker->parks, memory_order_relaxed );
+  stats->idle_usec = idle;
+  stats->busy_usec = now - worker->started_usec > idle ? now - worker->started_usec - idle : 0;
+}
@@ -1,6 +1,13 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 
 #include "threads.h"
 #include "logger.h"
@@ -63,11 +70,13 @@ void dna_cond_init( pthread_cond_t *cond ) {
   pthread_cond_init( cond, NULL );
 }
 
-void dna_cond_timedwait( pthread_cond_t *cond, pthread_mutex_t *mutex, const struct timespec *abstime  ) {
+/* Returns 0 when signalled, ETIMEDOUT once abstime has passed */
+int dna_cond_timedwait( pthread_cond_t *cond, pthread_mutex_t *mutex, const struct timespec *abstime  ) {
   int code = 0;
-  while ((code = pthread_cond_timedwait( cond, mutex, abstime) )) {
+  while ((code = pthread_cond_timedwait( cond, mutex, abstime) ) && code != ETIMEDOUT) {
     dna_log(ERROR, "cond_timedwait failed (%i), trying again...", code);
   }
+  return code;
 }
 
 void dna_cond_wait( pthread_cond_t *cond, pthread_mutex_t *mutex ) {
@@ -135,3 +144,113 @@ void dna_thread_detach( pthread_t *thread ) {
 void dna_thread_context_join( dna_thread_context_t * ctx ) {
   pthread_join( *ctx->thread, NULL );
 }
+
+void dna_futex_wait( atomic_int *addr, int expected ) {
+  /* EAGAIN (already changed) and EINTR both just send the caller back to re-check */
+  syscall( SYS_futex, (int*) addr, FUTEX_WAIT_PRIVATE, expected, NULL, NULL, 0 );
+}
+
+void dna_futex_wake( atomic_int *addr, int count ) {
+  syscall( SYS_futex, (int*) addr, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0 );
+}
+
+/* Tell the CPU we're busy-waiting: saves power, and frees the core for a sibling hyperthread */
+void dna_cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#elif defined(__aarch64__)
+  __asm__ __volatile__( "yield" );
+#endif
+}
+
+long dna_time_usec() {
+  struct timespec now;
+  clock_gettime( CLOCK_MONOTONIC, &now );
+  return (long) now.tv_sec * 1000000L + now.tv_nsec / 1000L;
+}
+
+/* Read "quota period" (cgroup v2 cpu.max) or a lone number (cgroup v1) */
+int dna_read_longs_internal( const char *path, long *first, long *second ) {
+  FILE *file = fopen( path, "r" );
+  if ( !file ) {
+    return 0;
+  }
+  char quota[32] = { 0 };
+  int read = fscanf( file, "%31s %ld", quota, second );
+  fclose( file );
+  if ( read < 1 ) {
+    return 0;
+  }
+  *first = strcmp( quota, "max" ) ? atol( quota ) : -1;
+  return read;
+}
+
+/* CPUs' worth of time the cgroup quota allows us, rounded up, or 0 for no limit */
+int dna_cgroup_cpu_limit_internal() {
+  long quota = -1, period = 0;
+  char path[512] = "/sys/fs/cgroup/cpu.max";
+  FILE *file = fopen( "/proc/self/cgroup", "r" );
+  if ( file ) {
+    char line[400];
+    while ( fgets( line, sizeof(line), file ) ) {
+      if ( !strncmp( line, "0::", 3 ) ) {
+        line[strcspn( line, "\n" )] = '\0';
+        snprintf( path, sizeof(path), "/sys/fs/cgroup%s/cpu.max", line + 3 );
+      }
+    }
+    fclose( file );
+  }
+  if ( dna_read_longs_internal( path, &quota, &period ) < 2
+      && dna_read_longs_internal( "/sys/fs/cgroup/cpu.max", &quota, &period ) < 2 ) {
+    /* cgroup v1 */
+    long unused = 0;
+    if ( !dna_read_longs_internal( "/sys/fs/cgroup/cpu/cpu.cfs_quota_us", &quota, &unused )
+        || !dna_read_longs_internal( "/sys/fs/cgroup/cpu/cpu.cfs_period_us", &period, &unused ) ) {
+      return 0;
+    }
+  }
+  if ( quota <= 0 || period <= 0 ) {
+    return 0;
+  }
+  return (int) ((quota + period - 1) / period);
+}
+
+/* CPUs we may actually run on: our affinity mask, capped by any cgroup quota */
+int dna_cpu_count() {
+  int count = 0;
+  cpu_set_t set;
+  if ( !sched_getaffinity( 0, sizeof(set), &set ) ) {
+    count = CPU_COUNT( &set );
+  }
+  if ( count <= 0 ) {
+    count = (int) sysconf( _SC_NPROCESSORS_ONLN );
+  }
+  int limit = dna_cgroup_cpu_limit_internal();
+  if ( limit > 0 && limit < count ) {
+    count = limit;
+  }
+  return count > 0 ? count : 1;
+}
+
+/* Pin the thread to the slot'th CPU of our affinity mask, wrapping around */
+int dna_thread_pin( pthread_t *thread, int slot ) {
+  cpu_set_t allowed;
+  if ( sched_getaffinity( 0, sizeof(allowed), &allowed ) ) {
+    return errno;
+  }
+  int count = CPU_COUNT( &allowed );
+  if ( count <= 0 ) {
+    return EINVAL;
+  }
+  slot %= count;
+  int cpu = 0;
+  for ( cpu = 0; cpu < CPU_SETSIZE; cpu++ ) {
+    if ( CPU_ISSET( cpu, &allowed ) && slot-- == 0 ) {
+      break;
+    }
+  }
+  cpu_set_t set;
+  CPU_ZERO( &set );
+  CPU_SET( cpu, &set );
+  return pthread_setaffinity_np( *thread, sizeof(set), &set );
+}
@@ -0,0 +1,159 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include "trace.h"
+#include "logger.h"
+
+typedef struct trace_record_t trace_record_t;
+typedef struct trace_buffer_t trace_buffer_t;
+
+struct trace_record_t {
+  long ts;             // nanoseconds, dna_trace_now()
+  long dur;            // spans only
+  unsigned long flow;  // links an enqueue to its receive
+  unsigned long actor; // pid, for message events
+  unsigned long arg;   // message id, promise id or worker index
+  int type;
+};
+
+/* One per thread that has recorded anything; only that thread writes to it.
+   Buffers outlive their threads, so a joined pool can still be exported. */
+struct trace_buffer_t {
+  atomic_ulong count;
+  long tid;
+  char name[32];
+  trace_buffer_t *next;
+  trace_record_t records[TRACE_BUFFER_SIZE];
+};
+
+static const char *trace_names[TRACE_EVENT_TYPES] = {
+  "enqueue", "dequeue", "receive", "resolve", "park"
+};
+static const char *trace_arg_names[TRACE_EVENT_TYPES] = {
+  "message", "message", "message", "promise", "worker"
+};
+
+atomic_int dna_trace_on = 0;
+
+static trace_buffer_t *_Atomic trace_buffers = NULL;
+static _Thread_local trace_buffer_t *trace_buffer = NULL;
+static _Thread_local char trace_thread_name[32] = "";
+static atomic_long trace_window_begin = 0;
+static atomic_long trace_window_end = 0;
+
+long dna_trace_now() {
+  struct timespec now;
+  clock_gettime( CLOCK_MONOTONIC, &now );
+  return (long) now.tv_sec * 1000000000L + now.tv_nsec;
+}
+
+void dna_trace_name_thread( const char *name, int index ) {
+  snprintf( trace_thread_name, sizeof(trace_thread_name), "%s/%i", name, index );
+  if ( trace_buffer ) {
+    strcpy( trace_buffer->name, trace_thread_name );
+  }
+}
+
+trace_buffer_t *trace_buffer_create_internal() {
+  trace_buffer_t *buffer = (trace_buffer_t*) malloc( sizeof(trace_buffer_t) );
+  atomic_init( &buffer->count, 0 );
+  buffer->tid = (long) syscall( SYS_gettid );
+  if ( trace_thread_name[0] ) {
+    strcpy( buffer->name, trace_thread_name );
+  } else {
+    snprintf( buffer->name, sizeof(buffer->name), "thread %li", buffer->tid );
+  }
+  buffer->next = atomic_load( &trace_buffers );
+  while ( !atomic_compare_exchange_weak( &trace_buffers, &buffer->next, buffer ) );
+  trace_buffer = buffer;
+  return buffer;
+}
+
+void dna_trace_event( trace_event_type_t type, long start, unsigned long flow, unsigned long actor, unsigned long arg ) {
+  trace_buffer_t *buffer = trace_buffer ? trace_buffer : trace_buffer_create_internal();
+  unsigned long count = atomic_load_explicit( &buffer->count, memory_order_relaxed );
+  trace_record_t *record = &buffer->records[count & (TRACE_BUFFER_SIZE - 1)];
+  long now = dna_trace_now();
+  record->ts = start ? start : now;
+  record->dur = start ? now - start : 0;
+  record->flow = flow;
+  record->actor = actor;
+  record->arg = arg;
+  record->type = type;
+  atomic_store_explicit( &buffer->count, count + 1, memory_order_release );
+}
+
+void dna_trace_start() {
+#ifdef MELON_TRACE
+  atomic_store( &trace_window_end, 0 );
+  atomic_store( &trace_window_begin, dna_trace_now() );
+  atomic_store( &dna_trace_on, 1 );
+#else
+  dna_log(WARN, "melon was built without MELON_TRACE: there is nothing to trace.");
+#endif
+}
+
+void dna_trace_stop() {
+  atomic_store( &dna_trace_on, 0 );
+  atomic_store( &trace_window_end, dna_trace_now() );
+}
+
+/* Chrome wants microseconds; we keep the nanoseconds as decimals */
+void trace_write_record_internal( FILE *out, trace_buffer_t *buffer, trace_record_t *record, long begin ) {
+  double ts = (record->ts - begin) / 1000.0;
+  const char *name = trace_names[record->type];
+  if ( record->type == TRACE_ENQUEUE && record->flow ) {
+    fprintf( out, ",\n{\"name\":\"message\",\"cat\":\"melon\",\"ph\":\"s\",\"id\":\"0x%lx\",\"ts\":%.3f,\"pid\":1,\"tid\":%li}",
+        record->flow, ts, buffer->tid );
+  }
+  if ( record->type == TRACE_RECEIVE && record->flow ) {
+    fprintf( out, ",\n{\"name\":\"message\",\"cat\":\"melon\",\"ph\":\"f\",\"bp\":\"e\",\"id\":\"0x%lx\",\"ts\":%.3f,\"pid\":1,\"tid\":%li}",
+        record->flow, ts, buffer->tid );
+  }
+  if ( record->type == TRACE_RECEIVE || record->type == TRACE_PARK ) {
+    fprintf( out, ",\n{\"name\":\"%s\",\"cat\":\"melon\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%li",
+        name, ts, record->dur / 1000.0, buffer->tid );
+  } else {
+    fprintf( out, ",\n{\"name\":\"%s\",\"cat\":\"melon\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,\"pid\":1,\"tid\":%li",
+        name, ts, buffer->tid );
+  }
+  if ( record->actor ) {
+    fprintf( out, ",\"args\":{\"actor\":%lu,\"%s\":%lu}}", record->actor, trace_arg_names[record->type], record->arg );
+  } else {
+    fprintf( out, ",\"args\":{\"%s\":%lu}}", trace_arg_names[record->type], record->arg );
+  }
+}
+
+/* Whatever each ring still holds from [begin, end]: rings keep their newest
+   TRACE_BUFFER_SIZE events, so a long window loses its start. */
+int dna_trace_write( const char *path ) {
+  FILE *out = fopen( path, "w" );
+  if ( !out ) {
+    dna_log(ERROR, "Couldn't open %s to write a trace.", path);
+    return -1;
+  }
+  long begin = atomic_load( &trace_window_begin );
+  long end = atomic_load( &trace_window_end );
+  fprintf( out, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n" );
+  fprintf( out, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"melon\"}}" );
+  trace_buffer_t *buffer = NULL;
+  for ( buffer = atomic_load( &trace_buffers ); buffer; buffer = buffer->next ) {
+    fprintf( out, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%li,\"args\":{\"name\":\"%s\"}}",
+        buffer->tid, buffer->name );
+    unsigned long count = atomic_load_explicit( &buffer->count, memory_order_acquire );
+    unsigned long i = count > TRACE_BUFFER_SIZE ? count - TRACE_BUFFER_SIZE : 0;
+    for ( ; i < count; i++ ) {
+      trace_record_t *record = &buffer->records[i & (TRACE_BUFFER_SIZE - 1)];
+      if ( record->ts < begin || (end && record->ts > end) ) {
+        continue;
+      }
+      trace_write_record_internal( out, buffer, record, begin );
+    }
+  }
+  fprintf( out, "\n]}\n" );
+  return fclose( out ) ? -1 : 0;
+}
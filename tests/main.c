@@ -3,6 +3,8 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <unistd.h>
+#include <sched.h>
+#include <stdatomic.h>
 #include <check.h>
 
 #include "melon.h"
@@ -13,8 +15,7 @@
 * - convert to check.h unit tests.
 * - write an actor-ring test, many actors in a ring, sending messages along the ring
 * - mirror android-actors tests
-* - profile and optimize fifo, thread_pool, actor
-* - determine what our core benchmarks are
+* - profile and optimize fifo, thread_pool, actor (see bench/, melon-bench)
 */
 
 static fifo_t *fifo = NULL;
@@ -85,6 +86,47 @@ void test_fifo() {
   }
 }
 
+void *fifo_drain_later( void *arg ) {
+  fifo_t *bounded = (fifo_t*) arg;
+  sleep_for( 1 );
+  fifo_pop( bounded );
+  return NULL;
+}
+
+void *fifo_drain_now( void *arg ) {
+  fifo_pop( (fifo_t*) arg );
+  return NULL;
+}
+
+void test_bounded_fifo() {
+  dna_log(INFO,  "<-------------------- test_bounded_fifo ---------------------");
+  int a = 1, b = 2, c = 3;
+  fifo_t *bounded = fifo_create("<bounded fifo>", 2);
+  int pushed = fifo_try_push( bounded, &a ) + fifo_try_push( bounded, &b );
+  int refused = !fifo_try_push( bounded, &c ) && !fifo_push_timed( bounded, &c, 10000 );
+
+  /* a blocking push has to wait for the pop in the pool */
+  thread_pool_t *pool = thread_pool_create("<bounded fifo pool>", 1);
+  thread_pool_enqueue( pool, &fifo_drain_later, bounded );
+  fifo_push( bounded, &c );
+  long count = fifo_count( bounded );
+  int first = *(int*) fifo_pop( bounded );
+
+  /* a burst larger than the bound goes in as the pool makes room */
+  int burst[3] = { 4, 5, 6 };
+  void *items[3] = { &burst[0], &burst[1], &burst[2] };
+  thread_pool_enqueue( pool, &fifo_drain_now, bounded );
+  thread_pool_enqueue( pool, &fifo_drain_now, bounded );
+  fifo_push_n( bounded, items, 3 );
+  int fifth = *(int*) fifo_pop( bounded );
+  int last = *(int*) fifo_pop( bounded );
+
+  thread_pool_exit_all( pool );
+  thread_pool_destroy( pool );
+  fifo_destroy( bounded );
+  dna_log(INFO, "bounded fifo: %s", (pushed == 2 && refused && count == 2 && first == 2 && fifth == 5 && last == 6 ? "PASSED" : "FAILED") );
+}
+
 void test_empty_thread_pool() {
   dna_log(INFO,  "<-------------------- test_empty_thread_pool ---------------------");
   int i = 0;
@@ -102,10 +144,35 @@ void test_empty_thread_pool() {
   }
 }
 
+void *idle_count_task( void *ran ) {
+  atomic_fetch_add( (atomic_int*) ran, 1 );
+  return NULL;
+}
+
+void test_idle_thread_pool_parks() {
+  dna_log(INFO,  "<-------------------- test_idle_thread_pool_parks ---------------------");
+  thread_pool_t *pool = thread_pool_create("<idle pool>", 4);
+  long deadline = dna_time_usec() + 2000000;
+  while ( atomic_load( &pool->sleeping ) < 4 && dna_time_usec() < deadline ) {
+    sched_yield();
+  }
+  int parked = atomic_load( &pool->sleeping );
+  /* work still gets picked up by a parked pool, and exit wakes everyone */
+  atomic_int ran = 0;
+  thread_pool_enqueue( pool, &idle_count_task, &ran );
+  while ( atomic_load( &ran ) < 1 && dna_time_usec() < deadline + 2000000 ) {
+    sched_yield();
+  }
+  thread_pool_exit_all( pool );
+  thread_pool_destroy( pool );
+  dna_log(INFO, "idle pool: %i of 4 workers parked, %i task ran: %s", parked, atomic_load( &ran ),
+      (parked == 4 && atomic_load( &ran ) == 1 ? "PASSED" : "FAILED") );
+}
+
 void test_busy_thread_pool() {
   dna_log(INFO,  "<-------------------- test_busy_thread_pool  ---------------------");
   fifo = fifo_create("<(busy_thread_pool) value fifo>", 0);
-  thread_pool_t *pool = thread_pool_create("<busy thread pool>", 8); // should auto-determine thread count maybe?
+  thread_pool_t *pool = thread_pool_create("<busy thread pool>", dna_cpu_count());
   dna_log(DEBUG, "adding %i tasks to the queue...", ELEMS);
   int i = 0;
   for( i = 0; i < ELEMS; i++ ) {
@@ -124,7 +191,7 @@ void test_busy_thread_pool() {
 void test_few_tasks_thread_pool() {
   dna_log(INFO,  "<-------------------- test_few_tasks_thread_pool  ---------------------");
   fifo = fifo_create("<(busy_thread_pool) value fifo>", 0);
-  thread_pool_t *pool = thread_pool_create("<few tasks thread pool>", 8); // should auto-determine thread count maybe?
+  thread_pool_t *pool = thread_pool_create("<few tasks thread pool>", dna_cpu_count());
   dna_log(DEBUG, "adding %i tasks to the queue...", ELEMS);
   int i = 0;
   for( i = 0; i < 1; i++ ) {
@@ -141,6 +208,41 @@ void test_few_tasks_thread_pool() {
   fifo_destroy( fifo );
 }
 
+static thread_pool_t *stealing_pool = NULL;
+static atomic_long stealing_done;
+
+void *count_task( void *nothing ) {
+  atomic_fetch_add( &stealing_done, 1 );
+  return NULL;
+}
+
+/* enqueued from a worker, so the children land on that worker's deque and the others have to steal them */
+void *spawn_tasks( void *nothing ) {
+  int i = 0;
+  for ( i = 0; i < 100; i++ ) {
+    thread_pool_enqueue( stealing_pool, &count_task, NULL );
+  }
+  return NULL;
+}
+
+void test_work_stealing_thread_pool() {
+  dna_log(INFO,  "<-------------------- test_work_stealing_thread_pool  ---------------------");
+  atomic_init( &stealing_done, 0 );
+  stealing_pool = thread_pool_create_mode("<work stealing pool>", 8, THREAD_POOL_WORK_STEALING);
+  int i = 0;
+  for( i = 0; i < 100; i++ ) {
+    thread_pool_enqueue(stealing_pool, &spawn_tasks, NULL);
+  }
+  while ( atomic_load( &stealing_done ) < 100 * 100 ) {
+    sched_yield();
+  }
+  thread_pool_exit_all(stealing_pool);
+  thread_pool_join_all(stealing_pool);
+  thread_pool_destroy(stealing_pool);
+  dna_log(INFO, "work stealing: ran %lu tasks: %s", atomic_load( &stealing_done ),
+      (atomic_load( &stealing_done ) == 100 * 100 ? "PASSED" : "FAILED") );
+}
+
 typedef enum {
   PING = 0,
   PONG = 1,
@@ -201,7 +303,7 @@ promise_t *actor_ping_receive( actor_t *this, message_t *msg ) {
 
 
 void test_actor_system_promise_chain() {
-  dna_log(DEBUG,  "<-------------------- test_actor_system_promise_chain ---------------------");
+  dna_log(INFO,  "<-------------------- test_actor_system_promise_chain ---------------------");
   actor_system_t *actor_system = actor_system_create("stuff");
 
   actor_t *actor1 = actor_create( &actor_ping_receive, "ping" );
@@ -215,37 +317,30 @@ void test_actor_system_promise_chain() {
 
   actor_system_run( actor_system );
 
-  void *val = promise_get( promise );
-  if (val) {
-    message_t *response = (message_t*)val;
-    dna_log(DEBUG, "resolved promise: %s", (response->type == DONE ? "PASSED" : "FAILED") );
-  }
+  message_t *response = (message_t*) promise_get( promise );
+  dna_log(INFO, "resolved promise: %s", (response && response->type == DONE ? "PASSED" : "FAILED") );
 
   actor_kill( actor1, NULL );
   actor_kill( actor2, NULL );
 
   thread_pool_join_all( actor_system->thread_pool );
   actor_system_destroy( actor_system );
+  actor_destroy( actor1 );
+  actor_destroy( actor2 );
 }
 
 promise_t *actor_nochain_receive( actor_t *this, message_t *msg ) {
   switch( msg->type ) {
     case PING: {
-      if (msg->id % 100000 == 0) {
-        dna_log(DEBUG, "%s-> PING ->%s %lu", this->name, msg->from->name, msg->id);
-      }
       message_t *response = actor_message_create(this, NULL, (msg->id < TEST_MESSAGE_COUNT ? PONG : DONE) );
       response->id = msg->id + 1;
-      actor_send(msg->from, response);
+      actor_tell( msg->from, response );
       return NULL;
     };
     case PONG: {
-      if (msg->id % 100000 == 0) {
-        dna_log(DEBUG, "%s-> PONG ->%s %lu", this->name, msg->from->name, msg->id);
-      }
       message_t *response = actor_message_create(this, NULL, (msg->id < TEST_MESSAGE_COUNT ? PING : DONE) );
       response->id = msg->id + 1;
-      actor_send(msg->from, response);
+      actor_tell( msg->from, response );
       return NULL;
     };
     case DONE: {
@@ -258,9 +353,8 @@ promise_t *actor_nochain_receive( actor_t *this, message_t *msg ) {
   return NULL;
 }
 
-void test_actor_system_no_chain() {
-  dna_log(INFO,  "<-------------------- test_actor_system_nochain  ---------------------");
-  actor_system_t *actor_system = actor_system_create("stuff");
+void test_actor_system_no_chain_config( actor_system_config_t *config ) {
+  actor_system_t *actor_system = actor_system_create_with_config("stuff", config);
   /* create actors and add them to the system */
   actor_t *actor1 = actor_create( &actor_nochain_receive, "ping" );
   actor_t *actor2 = actor_create( &actor_nochain_receive, "pong" );
@@ -268,37 +362,650 @@ void test_actor_system_no_chain() {
   actor_system_add( actor_system, actor2 );
   message_t *message = actor_message_create( actor2, NULL, PING );
   message->id = 1;
-  actor_send( actor1, message );
+  actor_tell( actor1, message );
   actor_system_run( actor_system );
 
   /* immediately join, blocking the main thread until all work is complete. */
   thread_pool_join_all( actor_system->thread_pool );
+  long migrations = atomic_load( &actor1->migrations ) + atomic_load( &actor2->migrations );
+  actor_stats_t ping, pong;
+  actor_stats( actor1, &ping );
+  actor_stats( actor2, &pong );
+  dna_log(INFO, "nochain: ping received %li in %li usec, pong %li in %li usec",
+      ping.received, ping.receive_usec, pong.received, pong.receive_usec);
+  dna_log(INFO, "nochain: %li migrations over %i messages: %s", migrations, TEST_MESSAGE_COUNT,
+      (migrations <= TEST_MESSAGE_COUNT / 100 ? "PASSED" : "FAILED") );
   actor_system_destroy( actor_system );
   actor_destroy( actor1 );
   actor_destroy( actor2 );
 }
 
+void test_actor_system_no_chain() {
+  dna_log(INFO,  "<-------------------- test_actor_system_nochain  ---------------------");
+  actor_system_config_t config;
+  actor_system_config_init( &config );
+  // the default scheduler, with enough workers for the actors to wander off
+  config.thread_count = 4;
+  test_actor_system_no_chain_config( &config );
+}
+
+void test_actor_system_work_stealing() {
+  dna_log(INFO,  "<-------------------- test_actor_system_work_stealing  ---------------------");
+  actor_system_config_t config;
+  actor_system_config_init( &config );
+  config.scheduler = THREAD_POOL_WORK_STEALING;
+  config.thread_count = 4;
+  config.pin_workers = 1;
+  test_actor_system_no_chain_config( &config );
+}
+
+static long throughput_received = 0;
+
+promise_t *actor_counting_receive( actor_t *this, message_t *msg ) {
+  throughput_received++;
+  return NULL;
+}
+
+void test_actor_throughput() {
+  dna_log(INFO,  "<-------------------- test_actor_throughput  ---------------------");
+  actor_system_t *actor_system = actor_system_create("throughput");
+  actor_t *counter = actor_create( &actor_counting_receive, "counter" );
+  actor_system_add( actor_system, counter );
+  actor_set_throughput( counter, 4, 0 );
+
+  promise_t *last = NULL;
+  int i = 0;
+  for (i = 0; i < 1000; i++) {
+    message_t *message = actor_message_create( counter, NULL, PING );
+    promise_destroy( last );
+    last = actor_send( counter, message );
+  }
+  message_t *batch[1000];
+  for (i = 0; i < 1000; i++) {
+    batch[i] = actor_message_create( counter, NULL, PING );
+  }
+  actor_send_batch( counter, batch, 1000 );
+  message_t *message = actor_message_create( counter, NULL, PING );
+  promise_destroy( last );
+  last = actor_send( counter, message );
+  actor_system_run( actor_system );
+  promise_get( last );
+  dna_log(INFO, "throughput: received %lu messages: %s", throughput_received,
+      (throughput_received == 2001 ? "PASSED" : "FAILED") );
+
+  actor_kill( counter, NULL );
+  thread_pool_join_all( actor_system->thread_pool );
+  actor_system_destroy( actor_system );
+  actor_destroy( counter );
+}
+
+#define INTERLEAVE_MESSAGES 20
+static unsigned long interleave_order[INTERLEAVE_MESSAGES];
+static atomic_int interleave_count = 0;
+
+promise_t *actor_interleave_receive( actor_t *this, message_t *msg ) {
+  int at = atomic_load( &interleave_count );
+  if ( at < INTERLEAVE_MESSAGES ) {
+    interleave_order[at] = this->pid;
+  }
+  atomic_store( &interleave_count, at + 1 );
+  return NULL;
+}
+
+/* Two busy actors on one worker take turns, 'quantum' messages at a time:
+   a receive task gives the worker up once its budget is spent. Returns how
+   often the worker switched from one actor to the other. */
+int test_actor_interleave_quantum( int quantum ) {
+  actor_system_config_t config;
+  actor_system_config_init( &config );
+  config.thread_count = 1;
+  config.throughput = quantum;
+  actor_system_t *actor_system = actor_system_create_with_config("interleave", &config);
+  actor_t *first = actor_create( &actor_interleave_receive, "first" );
+  actor_t *second = actor_create( &actor_interleave_receive, "second" );
+  actor_system_add( actor_system, first );
+  actor_system_add( actor_system, second );
+  atomic_store( &interleave_count, 0 );
+  int i = 0;
+  for (i = 0; i < INTERLEAVE_MESSAGES / 2; i++) {
+    actor_tell( first, actor_message_create( first, NULL, PING ) );
+    actor_tell( second, actor_message_create( second, NULL, PING ) );
+  }
+  actor_system_run( actor_system );
+  long deadline = dna_time_usec() + 5000000;
+  while ( atomic_load( &interleave_count ) < INTERLEAVE_MESSAGES && dna_time_usec() < deadline ) {
+    sched_yield();
+  }
+  int switches = 0;
+  for (i = 1; i < INTERLEAVE_MESSAGES; i++) {
+    switches += interleave_order[i] != interleave_order[i - 1];
+  }
+
+  actor_kill( first, NULL );
+  actor_kill( second, NULL );
+  thread_pool_join_all( actor_system->thread_pool );
+  actor_system_destroy( actor_system );
+  actor_destroy( first );
+  actor_destroy( second );
+  return switches;
+}
+
+void test_actor_throughput_interleave() {
+  dna_log(INFO,  "<-------------------- test_actor_throughput_interleave  ---------------------");
+  int one = test_actor_interleave_quantum( 1 );
+  int five = test_actor_interleave_quantum( 5 );
+  dna_log(INFO, "interleave: %i switches at throughput 1, %i at throughput 5: %s", one, five,
+      (one == INTERLEAVE_MESSAGES - 1 && five == INTERLEAVE_MESSAGES / 5 - 1 ? "PASSED" : "FAILED") );
+}
+
+static atomic_long then_sum;
+static atomic_int then_count;
+static atomic_long piped = 0;
+
+promise_t *actor_echo_receive( actor_t *this, message_t *msg ) {
+  return promise_resolved( msg->data );
+}
+
+static actor_t *relay_target = NULL;
+
+promise_t *actor_relay_receive( actor_t *this, message_t *msg ) {
+  actor_forward( relay_target, msg );
+  return NULL;
+}
+
+promise_t *actor_collect_receive( actor_t *this, message_t *msg ) {
+  atomic_store( &piped, (long) msg->data );
+  return NULL;
+}
+
+void then_sum_callback( void *resolution, void *arg ) {
+  atomic_fetch_add( &then_sum, (long) resolution );
+  atomic_fetch_add( (atomic_int*) arg, 1 );
+}
+
+void test_promise_then() {
+  dna_log(INFO,  "<-------------------- test_promise_then  ---------------------");
+  actor_system_t *actor_system = actor_system_create("then");
+  actor_t *echo = actor_create( &actor_echo_receive, "echo" );
+  actor_t *collect = actor_create( &actor_collect_receive, "collect" );
+  actor_t *relay = actor_create( &actor_relay_receive, "relay" );
+  actor_system_add( actor_system, echo );
+  actor_system_add( actor_system, collect );
+  actor_system_add( actor_system, relay );
+  relay_target = echo;
+  actor_system_run( actor_system );
+
+  atomic_init( &then_sum, 0 );
+  atomic_init( &then_count, 0 );
+  long i = 0;
+  for (i = 1; i <= 100; i++) {
+    message_t *message = actor_message_create( echo, (void*) i, PING );
+    promise_then( actor_send( echo, message ), &then_sum_callback, &then_count );
+  }
+  message_t *message = actor_message_create( echo, (void*) 42L, PING );
+  actor_pipe( actor_send( echo, message ), collect, actor_message_create( echo, NULL, PONG ) );
+
+  long deadline = dna_time_usec() + 5000000;
+  while ( (atomic_load( &then_count ) < 100 || atomic_load( &piped ) != 42)
+      && dna_time_usec() < deadline ) {
+    sched_yield();
+  }
+  long relayed = (long) promise_get( actor_send( relay, actor_message_create( relay, (void*) 7L, PING ) ) );
+  dna_log(INFO, "forward: relayed %li: %s", relayed, (relayed == 7 ? "PASSED" : "FAILED") );
+
+  dna_log(INFO, "then: %i continuations summing to %li, piped %li: %s",
+      atomic_load( &then_count ), atomic_load( &then_sum ), atomic_load( &piped ),
+      (atomic_load( &then_sum ) == 5050 && atomic_load( &piped ) == 42 ? "PASSED" : "FAILED") );
+
+  // a continuation on a promise that gets chained waits for the chain's value
+  atomic_int chained = 0;
+  long before = atomic_load( &then_sum );
+  promise_t *inner = promise_create();
+  promise_then( promise_retain( inner ), &then_sum_callback, &chained );
+  promise_t *outer = promise_create();
+  promise_chain( outer, inner );
+  int early = atomic_load( &chained );
+  promise_set( outer, (void*) 9L );
+  promise_destroy( outer );
+  dna_log(INFO, "then chained: %i early, %i after set, value %li: %s", early, atomic_load( &chained ),
+      atomic_load( &then_sum ) - before,
+      (early == 0 && atomic_load( &chained ) == 1 && atomic_load( &then_sum ) - before == 9 ? "PASSED" : "FAILED") );
+
+  actor_kill( echo, NULL );
+  actor_kill( collect, NULL );
+  actor_kill( relay, NULL );
+  thread_pool_join_all( actor_system->thread_pool );
+  actor_system_destroy( actor_system );
+  actor_destroy( echo );
+  actor_destroy( collect );
+  actor_destroy( relay );
+}
+
+void test_promise_settle() {
+  dna_log(INFO,  "<-------------------- test_promise_settle  ---------------------");
+  // a second set is refused, and leaves the first value alone
+  promise_t *twice = promise_create();
+  promise_set( twice, (void*) 1L );
+  promise_set( twice, (void*) 2L );
+  long first = (long) promise_get( twice );
+
+  // chaining a promise that already forwards somewhere links the two targets up
+  promise_t *a = promise_create();
+  promise_t *b = promise_create();
+  promise_t *link = promise_create();
+  promise_chain( a, promise_retain( link ) );
+  promise_chain( b, promise_retain( link ) );
+  promise_set( link, (void*) 5L );
+  // don't block on a promise that was left behind
+  long at_a = -1, at_b = -1;
+  if ( promise_state( a ) == PROMISE_WAITING ) {
+    promise_destroy( a );
+  } else {
+    at_a = (long) promise_get( a );
+  }
+  if ( promise_state( b ) == PROMISE_WAITING ) {
+    promise_destroy( b );
+  } else {
+    at_b = (long) promise_get( b );
+  }
+  long at_link = (long) promise_get( link );
+  dna_log(INFO, "settle: double set kept %li, chained twice: %li, %li, %li: %s", first, at_a, at_b, at_link,
+      (first == 1 && at_a == 5 && at_b == 5 && at_link == 5 ? "PASSED" : "FAILED") );
+}
+
+void test_actor_system_arena() {
+  dna_log(INFO,  "<-------------------- test_actor_system_arena  ---------------------");
+  actor_system_config_t config;
+  actor_system_config_init( &config );
+  config.message_capacity = 64;
+  config.huge_pages = 1;
+  actor_system_t *actor_system = actor_system_create_with_config("arena", &config);
+
+  message_t *messages[65];
+  int from_arena = 0;
+  int i = 0;
+  for (i = 0; i < 65; i++) {
+    messages[i] = actor_system_message_get( actor_system, NULL, PING, NULL );
+    from_arena += (messages[i]->flags & MESSAGE_FROM_ARENA) ? 1 : 0;
+  }
+  for (i = 0; i < 65; i++) {
+    actor_system_message_put( actor_system, messages[i] );
+  }
+  actor_system_destroy( actor_system );
+  dna_log(INFO, "arena: %i of 65 messages from a 64 message arena: %s", from_arena,
+      (from_arena == 64 ? "PASSED" : "FAILED") );
+}
+
+typedef struct {
+  int a;
+  int b;
+} pair_t;
+
+promise_t *actor_add_receive( actor_t *this, message_t *msg ) {
+  pair_t *pair = (pair_t*) msg->data;
+  return promise_resolved( (void*) (long) (pair->a + pair->b) );
+}
+
+void test_message_payload() {
+  dna_log(INFO,  "<-------------------- test_message_payload  ---------------------");
+  actor_system_config_t config;
+  actor_system_config_init( &config );
+  config.message_inline = 32;
+  actor_system_t *actor_system = actor_system_create_with_config("payload", &config);
+  actor_t *adder = actor_create( &actor_add_receive, "adder" );
+  actor_system_add( actor_system, adder );
+  actor_system_run( actor_system );
+
+  pair_t pair = { 20, 22 };
+  message_t *small = actor_message_create_copy( adder, &pair, sizeof(pair), PING );
+  int inlined = small->data == small->payload && !(small->flags & MESSAGE_OWNS_DATA);
+  long sum = (long) promise_get( actor_send( adder, small ) );
+
+  char big[100];
+  memset( big, 7, sizeof(big) );
+  message_t *large = actor_message_create_copy( adder, big, sizeof(big), PING );
+  int copied = (large->flags & MESSAGE_OWNS_DATA) && !memcmp( large->data, big, sizeof(big) );
+  actor_message_destroy( adder, large );
+
+  dna_log(INFO, "payload: inline %i, sum %li, large copied %i: %s", inlined, sum, copied,
+      (inlined && sum == 42 && copied ? "PASSED" : "FAILED") );
+
+  actor_kill( adder, NULL );
+  thread_pool_join_all( actor_system->thread_pool );
+  actor_system_destroy( actor_system );
+  actor_destroy( adder );
+}
+
+/* occurrences of 'needle' in the file at 'path' */
+int count_in_file( const char *path, const char *needle ) {
+  FILE *file = fopen( path, "r" );
+  if ( !file ) {
+    return -1;
+  }
+  char line[1024];
+  int count = 0;
+  while ( fgets( line, sizeof(line), file ) ) {
+    const char *at = line;
+    while ( (at = strstr( at, needle )) ) {
+      count++;
+      at += strlen( needle );
+    }
+  }
+  fclose( file );
+  return count;
+}
+
+void test_trace() {
+  dna_log(INFO,  "<-------------------- test_trace  ---------------------");
+#ifndef MELON_TRACE
+  // without it, dna_trace() compiles away and there is nothing to check
+  dna_log(INFO, "trace: built without MELON_TRACE: SKIPPED");
+#else
+  actor_system_t *actor_system = actor_system_create("trace");
+  actor_t *adder = actor_create( &actor_add_receive, "adder" );
+  actor_system_add( actor_system, adder );
+  actor_system_run( actor_system );
+
+  const char *path = "/tmp/melon-trace.json";
+  pair_t pair = { 1, 2 };
+  dna_trace_start();
+  int i = 0;
+  long sum = 0;
+  for ( i = 0; i < 10; i++ ) {
+    sum += (long) promise_get( actor_send( adder, actor_message_create_copy( adder, &pair, sizeof(pair), PING ) ) );
+  }
+  dna_trace_stop();
+  int written = dna_trace_write( path ) == 0;
+  int receives = count_in_file( path, "\"name\":\"receive\"" );
+  int flows = count_in_file( path, "\"ph\":\"f\"" );
+  dna_log(INFO, "trace: %i receives, %i flows in %s: %s", receives, flows, path,
+      (written && sum == 30 && receives == 10 && flows == 10 ? "PASSED" : "FAILED") );
+  unlink( path );
+
+  actor_kill( adder, NULL );
+  thread_pool_join_all( actor_system->thread_pool );
+  actor_system_destroy( actor_system );
+  actor_destroy( adder );
+#endif
+}
+
+static atomic_long broadcast_sum = 0;
+static atomic_long broadcast_received = 0;
+
+promise_t *actor_subscriber_receive( actor_t *this, message_t *msg ) {
+  pair_t *pair = (pair_t*) msg->data;
+  atomic_fetch_add( &broadcast_sum, pair->a + pair->b );
+  atomic_fetch_add( &broadcast_received, 1 );
+  return NULL;
+}
+
+void test_actor_broadcast() {
+  dna_log(INFO,  "<-------------------- test_actor_broadcast  ---------------------");
+  actor_system_config_t config;
+  actor_system_config_init( &config );
+  config.scheduler = THREAD_POOL_WORK_STEALING;
+  actor_system_t *actor_system = actor_system_create_with_config("broadcast", &config);
+  actor_group_t *group = actor_group_create( actor_system, "subscribers" );
+  actor_t *subscribers[200];
+  int i = 0;
+  for (i = 0; i < 200; i++) {
+    subscribers[i] = actor_create( &actor_subscriber_receive, "subscriber" );
+    actor_system_add( actor_system, subscribers[i] );
+    actor_group_add( group, subscribers[i] );
+  }
+  actor_system_run( actor_system );
+
+  for (i = 1; i <= 10; i++) {
+    pair_t pair = { i, i };
+    actor_broadcast( group, PING, &pair, sizeof(pair) );
+  }
+  long deadline = dna_time_usec() + 5000000;
+  while ( atomic_load( &broadcast_received ) < 2000 && dna_time_usec() < deadline ) {
+    sched_yield();
+  }
+  dna_log(INFO, "broadcast: %li deliveries summing to %li: %s",
+      atomic_load( &broadcast_received ), atomic_load( &broadcast_sum ),
+      (atomic_load( &broadcast_received ) == 2000 && atomic_load( &broadcast_sum ) == 200 * 110 ? "PASSED" : "FAILED") );
+
+  for (i = 0; i < 200; i++) {
+    actor_group_remove( group, subscribers[i] );
+    actor_kill( subscribers[i], NULL );
+  }
+  thread_pool_join_all( actor_system->thread_pool );
+  actor_system_destroy( actor_system );
+  for (i = 0; i < 200; i++) {
+    actor_destroy( subscribers[i] );
+  }
+}
+
+void test_actor_registry() {
+  dna_log(INFO,  "<-------------------- test_actor_registry  ---------------------");
+  actor_system_t *actor_system = actor_system_create("registry");
+  actor_t *actors[1000];
+  // actors 0-9 and 48-57 pair up as namesakes, registered before the table grows
+  const char *twins[10] = { "twin0", "twin1", "twin2", "twin3", "twin4",
+                            "twin5", "twin6", "twin7", "twin8", "twin9" };
+  int i = 0;
+  int found = 0, gone = 0, newest = 0;
+  for (i = 0; i < 1000; i++) {
+    actors[i] = actor_create( &actor_counting_receive, (i == 500 ? "named"
+        : (i < 10 ? twins[i] : (i >= 48 && i < 58 ? twins[i - 48] : "anonymous"))) );
+    actor_system_add( actor_system, actors[i] );
+  }
+  for (i = 0; i < 1000; i++) {
+    found += actor_system_lookup( actor_system, actors[i]->pid ) == actors[i];
+  }
+  int named = actor_system_lookup_name( actor_system, "named" ) == actors[500];
+  // the table grew four times since; the newer of each pair still comes first
+  for (i = 0; i < 10; i++) {
+    newest += actor_system_lookup_name( actor_system, twins[i] ) == actors[48 + i];
+  }
+  for (i = 0; i < 1000; i += 2) {
+    actor_kill( actors[i], NULL );
+  }
+  for (i = 0; i < 1000; i++) {
+    gone += actor_system_lookup( actor_system, actors[i]->pid ) == (i % 2 ? actors[i] : NULL);
+  }
+  int unnamed = actor_system_lookup_name( actor_system, "named" ) == NULL;
+  long left = actor_registry_count( actor_system->actors );
+  dna_log(INFO, "registry: found %i, %i after kills, %li left, %i newest namesakes: %s", found, gone, left, newest,
+      (found == 1000 && gone == 1000 && named && newest == 10 && unnamed && left == 500 ? "PASSED" : "FAILED") );
+
+  for (i = 1; i < 1000; i += 2) {
+    actor_kill( actors[i], NULL );
+  }
+  thread_pool_join_all( actor_system->thread_pool );
+  actor_system_destroy( actor_system );
+  for (i = 0; i < 1000; i++) {
+    actor_destroy( actors[i] );
+  }
+}
+
+static long priority_seen = 0;
+static long priority_at = -1;
+
+promise_t *actor_priority_receive( actor_t *this, message_t *msg ) {
+  if ( msg->type == PONG ) {
+    priority_at = priority_seen;
+  }
+  priority_seen++;
+  return NULL;
+}
+
+void test_actor_priority() {
+  dna_log(INFO,  "<-------------------- test_actor_priority  ---------------------");
+  actor_system_t *actor_system = actor_system_create("priority");
+  actor_t *actor = actor_create( &actor_priority_receive, "priority" );
+  actor_system_add( actor_system, actor );
+  int i = 0;
+  for (i = 0; i < 100; i++) {
+    actor_tell( actor, actor_message_create( actor, NULL, PING ) );
+  }
+  message_t *urgent = actor_message_create( actor, NULL, PONG );
+  message_set_priority( urgent, 1 );
+  promise_t *last = actor_send( actor, actor_message_create( actor, NULL, PING ) );
+  actor_tell( actor, urgent );
+  actor_system_run( actor_system );
+  promise_get( last );
+  dna_log(INFO, "priority: received %li, urgent one at %li: %s", priority_seen, priority_at,
+      (priority_seen == 102 && priority_at == 0 && actor->state == ACTOR_ALIVE ? "PASSED" : "FAILED") );
+
+  actor_kill( actor, NULL );
+  thread_pool_join_all( actor_system->thread_pool );
+  actor_system_destroy( actor_system );
+  actor_destroy( actor );
+}
+
 void test_logger() {
   dna_log(INFO, " -> info ");
   dna_log(WARN, " -> warn %s", "log level.");
   dna_log(ERROR, " !! %s", "log level.");
   dna_log(DEBUG, " <><> %s and %i", "log level.", 42);
   dna_log(VERBOSE, " verbose", "log level.", 99);
+
+  // a level that's off never evaluates its arguments
+  int evaluated = 0;
+  dna_log_set_level( WARN );
+  dna_log(DEBUG, "not logged %i", ++evaluated);
+  dna_log(WARN, " -> warn at level %i", dna_log_get_level());
+  int quiet = (evaluated == 0);
+
+  // flush writes out every thread's records before it returns
+  dna_log_flush();
+  unsigned long dropped = dna_log_dropped();
+  dna_log_set_level( GLOBAL_LOG_LEVEL );
+  dna_log(INFO, "logger: %s", (quiet && dropped == 0 && dna_log_get_level() == GLOBAL_LOG_LEVEL ? "PASSED" : "FAILED") );
+}
+
+void test_actor_system_stats() {
+  dna_log(INFO,  "<-------------------- test_actor_system_stats  ---------------------");
+  actor_system_config_t config;
+  actor_system_config_init( &config );
+  config.scheduler = THREAD_POOL_WORK_STEALING;
+  actor_system_t *actor_system = actor_system_create_with_config("stats", &config);
+  actor_t *adder = actor_create( &actor_add_receive, "adder" );
+  actor_system_add( actor_system, adder );
+
+  // queued up before the actor runs, so they all wait in the mailbox
+  pair_t pair = { 1, 2 };
+  message_t *messages[99];
+  int i = 0;
+  for ( i = 0; i < 99; i++ ) {
+    messages[i] = actor_message_create_copy( adder, &pair, sizeof(pair), PING );
+  }
+  actor_send_batch( adder, messages, 99 );
+  long created = 0;
+  long live = 0;
+  promise_counts( &created, &live );
+  promise_t *last = actor_send( adder, actor_message_create_copy( adder, &pair, sizeof(pair), PING ) );
+  actor_system_run( actor_system );
+  long sum = (long) promise_get( last );
+
+  actor_system_stats_t *stats = actor_system_stats( actor_system );
+  actor_stats_t *actor = &stats->actors[0];
+  long sojourns = 0;
+  for ( i = 0; i < ACTOR_SOJOURN_BUCKETS; i++ ) {
+    sojourns += actor->sojourn[i];
+  }
+  long tasks = 0;
+  for ( i = 0; i < stats->worker_count; i++ ) {
+    tasks += stats->workers[i].tasks;
+  }
+  dna_log(INFO, "stats: %li received, depth %li (max %li), %li timed, %li usec in receive, "
+      "%li tasks, pool %li of %li, %li allocs, %li promises (%li live): %s",
+      actor->received, actor->depth, actor->depth_max, sojourns, actor->receive_usec,
+      tasks, stats->message_pool, stats->message_capacity, stats->message_allocs,
+      stats->promises_created, stats->promises_live,
+      (sum == 3 && stats->actor_count == 1 && actor->pid == adder->pid && actor->received == 100
+        && actor->depth == 0 && actor->depth_max == 100 && sojourns == 100 && tasks >= 1
+        && stats->message_pool + 100 >= stats->message_capacity && stats->message_allocs == 0
+        && stats->promises_created > created ? "PASSED" : "FAILED") );
+  actor_system_stats_destroy( stats );
+
+  actor_kill( adder, NULL );
+  thread_pool_join_all( actor_system->thread_pool );
+  actor_system_destroy( actor_system );
+  actor_destroy( adder );
+}
+
+static atomic_int blocker_entered = 0;
+static atomic_int blocker_release = 0;
+static atomic_int pending_cleaned = 0;
+
+promise_t *actor_blocker_receive( actor_t *this, message_t *msg ) {
+  atomic_store( &blocker_entered, 1 );
+  while ( !atomic_load( &blocker_release ) ) {
+    sched_yield();
+  }
+  return NULL;
+}
+
+void pending_cleanup( void *arg ) {
+  atomic_fetch_add( &pending_cleaned, 1 );
+}
+
+/* A killed actor whose receive task is dropped on exit still holds an arena
+   message when the system goes away. */
+void test_actor_system_kill_pending() {
+  dna_log(INFO,  "<-------------------- test_actor_system_kill_pending  ---------------------");
+  actor_system_config_t config;
+  actor_system_config_init( &config );
+  config.thread_count = 1;
+  actor_system_t *actor_system = actor_system_create_with_config("kill pending", &config);
+  actor_t *blocker = actor_create( &actor_blocker_receive, "blocker" );
+  actor_t *victim = actor_create( &actor_add_receive, "victim" );
+  actor_system_add( actor_system, blocker );
+  actor_system_add( actor_system, victim );
+  actor_system_run( actor_system );
+
+  // the only worker is stuck in blocker, so victim's receive task stays queued
+  actor_tell( blocker, actor_message_create( blocker, NULL, PING ) );
+  while ( !atomic_load( &blocker_entered ) ) {
+    sched_yield();
+  }
+  pair_t pair = { 1, 2 };
+  message_t *pending = actor_message_create_copy( victim, &pair, sizeof(pair), PING );
+  int from_arena = (pending->flags & MESSAGE_FROM_ARENA) != 0;
+  actor_tell( victim, pending );
+  actor_kill( victim, &pending_cleanup );
+  thread_pool_exit_all( actor_system->thread_pool );
+  atomic_store( &blocker_release, 1 );
+  thread_pool_join_all( actor_system->thread_pool );
+  actor_system_destroy( actor_system );
+  int cleaned = atomic_load( &pending_cleaned );
+  actor_destroy( victim );
+
+  dna_log(INFO, "kill pending: arena message %i, %i drained before unmap: %s", from_arena, cleaned,
+      (from_arena && cleaned == 1 ? "PASSED" : "FAILED") );
 }
 
-/* All in all, tests are currently passing, however there is a 
-   memory swelling issue when the actor tests are run */
 int main(int argc, char *argv[]) {
   dna_log(INFO, "starting tests...");
 
   test_logger();
   test_empty_fifo();
   test_fifo();
+  test_bounded_fifo();
   test_empty_thread_pool();
+  test_idle_thread_pool_parks();
   test_busy_thread_pool();
   test_few_tasks_thread_pool();
+  test_work_stealing_thread_pool();
   test_actor_system_promise_chain();
   test_actor_system_no_chain();
+  test_actor_system_work_stealing();
+  test_actor_throughput();
+  test_actor_throughput_interleave();
+  test_actor_system_arena();
+  test_promise_then();
+  test_promise_settle();
+  test_message_payload();
+  test_trace();
+  test_actor_broadcast();
+  test_actor_registry();
+  test_actor_priority();
+  test_actor_system_stats();
+  test_actor_system_kill_pending();
 
   dna_log(INFO, "tests complete");
   return 0;